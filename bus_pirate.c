@@ -0,0 +1,2169 @@
+/*
+Bus Pirate binary I2C mode library for the 24xx EEPROM programs ... see bus_pirate.h.
+
+Creds:
+I owe a debt of gratitude to James Stephenson.  I used his I2CEEPROMWIN.c to understand how to
+to prepare and populate the write buffer and parse the response (among other things).  Thanks James!
+I also owe a debt of gratitude to Michael Sweet for his Serial Programming Guide for POSIX Operating Systems.
+And finally, thanks to the excellent tutorials on the Bus Pirate web site.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <termios.h>		// POSIX terminal control definitions
+#include <errno.h>		// Error number definitions
+#include <fcntl.h>		// File control definitions
+#include <strings.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>		// poll() to wait for Bus Pirate responses
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>	// Low latency mode for the USB serial driver
+#include <libgen.h>
+#include <ctype.h>
+#include <sys/mman.h>		// Memory map image files
+#include <sys/stat.h>
+#include <stdint.h>		// 64 bit words for streamvalidate
+#include <assert.h>		// Bulk write counts the encoders work out
+
+#include "bus_pirate.h"
+
+// Sanity checks on the sizes above ... if one of these fails, some frame can run off the end of a buffer
+_Static_assert ((BULKWRITEMAX >= 2) && (BULKWRITEMAX <= 16),
+                "A bulk write is up to 16 bytes (and the first one needs room for both addresses)");
+_Static_assert (BULKWRITEOK (1) && BULKWRITEOK (3), "The read header bulk writes (1 and up to 3 bytes) have to fit");
+_Static_assert ((EEPROMMAX % PAGEMAX == 0) && (PAGEMAX % PAGEMIN == 0), "Pages have to divide the EEPROM");
+_Static_assert ((RINGSIZE & (RINGSIZE - 1)) == 0, "RINGSIZE has to be a power of 2");
+_Static_assert (RINGSIZE > STREAMSIZE, "The ring has to hold a whole stream response");
+_Static_assert (RINGSIZE >= BURSTMAX + 2, "The ring has to hold a whole write then read response");
+_Static_assert (STREAMPAGES * 2 + 1 <= MAXTRANSACTIONS, "No room for the page writes and ACK polls of a stream");
+_Static_assert (STREAMPAGES * (PAGEWRITESIZE (PAGEMAX, 2) + ACKPOLLCOUNT * ACKPOLLSIZE) + ACKPOLLCOUNT * ACKPOLLSIZE <
+                STREAMSIZE, "STREAMPAGES page writes and their ACK polls (and a group for a busy page) don't fit");
+_Static_assert (READSIZE (2, READCHUNK) < STREAMSIZE, "A READCHUNK read doesn't fit in a stream");
+
+// Command templates.  The encoders copy these and patch in the addresses and data instead of building frames a byte
+// at a time.  The expect and mask templates are what the responses should look like (see streamvalidate):  a mask
+// byte of 0 means "anything goes" (data bytes, ACK poll answers).  The runs are READCHUNK read + ACK pairs and
+// ACKPOLLCOUNT ACK polls, repeated by the preprocessor.
+#define REPEAT4(x) x x x x
+#define REPEAT5(x) x x x x x
+#define READPAIRS(pair) REPEAT4 (REPEAT4 (REPEAT4 (pair pair)))
+#define ACKPOLLRUN(poll) REPEAT4 (REPEAT5 (poll))
+
+static const char readacks[] = READPAIRS ("\x4\x6");
+static const char readexpect[] = READPAIRS ("\0\1");
+static const char readmask[] = READPAIRS ("\0\xFF");
+static const char ackpolls[] = ACKPOLLRUN (ACKPOLL);
+static const char ackpollexpect[] = ACKPOLLRUN ("\1\1\0\1");
+static const char ackpollmask[] = ACKPOLLRUN ("\xFF\xFF\0\xFF");
+
+_Static_assert (sizeof (readacks) - 1 == 2 * READCHUNK, "readacks has to have READCHUNK reads");
+_Static_assert (sizeof (ackpolls) - 1 == ACKPOLLSIZE * ACKPOLLCOUNT, "ackpolls has to have ACKPOLLCOUNT polls");
+
+// I2C speeds in kHz ... the index is the value that goes in the speed command
+const int speeds[4] = {5, 50, 100, 400};
+
+// Names of the command types in the JSON summary ... same order as the STAT defines
+const char *statnames[STATTYPES] = {"mode_entry", "reset", "speed", "probe", "page_write", "ack_poll", "read",
+                                    "bulk_read"};
+
+// EEPROMs we know about (see struct eepromprofile) ... the 24LC08B is the default.  The write cycle is the data sheet
+// maximum.  The 24LC08B can't read across a block (256 bytes) in one go, the others read 1 KB bursts.
+const struct eepromprofile profiles[PROFILES] = {
+  {"24LC08B", 1024, 16, 1, 2, 5000, 256},
+  {"24LC256", 32768, 64, 2, 0, 5000, BURSTMAX},
+  {"24LC512", 65536, 128, 2, 0, 5000, BURSTMAX}
+};
+
+// Set up the serial port for the Bus Pirate.  Start from the existing port options and put the port in real raw mode:
+// 115200 baud, 8N1, no parity, no flow control, no echo, no line editing and no translation of CR/NL or any other
+// byte ... the Bus Pirate speaks binary.  VMIN and VTIME are 0 because bpfill does the waiting with poll().
+// The options don't take effect until we call tcsetattr, so call it last.
+//
+// Every small response (like a 1 byte ACK) also pays for the USB serial adapter's receive latency.  Ask the driver for
+// low latency mode and (for FTDI adapters like the one on the Bus Pirate) set the latency timer to 1 ms.  Neither one
+// is required ... not every driver supports them and the latency timer needs root.  Print what we got on stderr.
+// Returns 0 or -1 on error.
+int setupport (int fd, char *device) {
+
+  struct termios portopts;
+  struct serial_struct serialopts;
+  char name[64], path[128], latency[16];
+  const char *lowlatency;
+  FILE *timer;
+
+  if (tcgetattr (fd, &portopts) == -1) {
+    return -1;
+  }
+
+  cfmakeraw (&portopts);		// No echo, no canonical input, no signals, no CR/NL translation, no output processing
+  portopts.c_iflag &= ~(IXON | IXOFF | IXANY);	// No software flow control
+  portopts.c_cflag &= ~PARENB;		// Disable parity bit
+  portopts.c_cflag &= ~CSTOPB;		// Disable 2 stop bits ... use 1 stop instead
+  portopts.c_cflag &= ~CSIZE;		// Clear the existing character size bits ...
+  portopts.c_cflag |= CS8;		// ... and set 8 bit characters.  Note the OR ... AND with CS8 would clear them all!
+  portopts.c_cflag &= ~CRTSCTS;		// No hardware flow control
+  portopts.c_cflag |= CLOCAL | CREAD;	// Ignore the modem control lines and turn on the receiver
+  portopts.c_cc[VMIN] = 0;
+  portopts.c_cc[VTIME] = 0;
+  cfsetspeed (&portopts, B115200);
+
+  if (tcsetattr (fd, TCSANOW, &portopts) == -1) {
+    return -1;
+  }
+
+  lowlatency = "not supported";
+
+  if (ioctl (fd, TIOCGSERIAL, &serialopts) == 0) {
+    serialopts.flags |= ASYNC_LOW_LATENCY;
+    lowlatency = (ioctl (fd, TIOCSSERIAL, &serialopts) == 0) ? "on" : "not allowed";
+  }
+
+  snprintf (name, sizeof (name), "%s", device);	// basename is allowed to change its argument ... give it a copy
+  snprintf (path, sizeof (path), "/sys/bus/usb-serial/devices/%s/latency_timer", basename (name));
+  strcpy (latency, "unknown");
+  timer = fopen (path, "r+");
+
+  if (timer != NULL) {
+    fputs ("1", timer);
+    fflush (timer);
+    rewind (timer);
+
+    if (fgets (latency, sizeof (latency), timer) != NULL) {
+      latency[strcspn (latency, "\n")] = '\0';
+      strcat (latency, " ms");
+    }
+
+    fclose (timer);
+  }
+
+  fprintf (stderr, "%s:  115200 baud, 8N1, raw, low latency %s, latency timer %s\n", device, lowlatency, latency);
+
+  return 0;
+}
+
+// Open the serial port the Bus Pirate is attached to (like /dev/ttyUSB0) and set it up.  Open the port with R/W, no
+// delay and "no controlling terminal" options.  The latter option will keep unwanted keyboard abort signals from
+// affecting us.  Then clear all the flags ... a brute force way to clear the O_NDELAY flag so that writes block.
+// Returns 0 or -1 on error.
+int bpopen (struct buspirate *bp, char *device) {
+
+  bzero (bp, sizeof (struct buspirate));
+  snprintf (bp->device, sizeof (bp->device), "%s", device);
+  bp->speed = SPEEDDEFAULT;
+  bp->erroraddress = -1;
+  bp->stats.started = bpmicros ();
+  bp->profile = &profiles[0];
+  bp->stream.profile = bp->profile;
+  streamreset (&bp->stream);
+
+  bp->fd = open (device, O_RDWR | O_NOCTTY | O_NDELAY);
+
+  if (bp->fd == -1) {
+    return -1;
+  }
+
+  if ((fcntl (bp->fd, F_SETFL, 0) == -1) || (setupport (bp->fd, device) == -1)) {
+    close (bp->fd);
+    bp->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Close the serial port
+void bpclose (struct buspirate *bp) {
+
+  if (bp->fd != -1) {
+    close (bp->fd);
+    bp->fd = -1;
+  }
+}
+
+// Send length bytes of commands to the Bus Pirate.  Returns 0 or -1 on error.
+int bpsend (struct buspirate *bp, char *command, int length) {
+
+  int result, sent;
+
+  bp->roundtrips++;
+
+  for (sent = 0; sent < length; sent = sent + result) {
+    result = write (bp->fd, command + sent, length - sent);
+    bp->stats.writes++;
+
+    if ((result == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
+      result = 0;
+      continue;
+    }
+    if (result == -1) {
+      return -1;
+    }
+
+    bp->stats.byteswritten = bp->stats.byteswritten + result;
+  }
+
+  return 0;
+}
+
+// Wait until there are at least count bytes in the receive ring.  Use poll() so that we return as soon as the bytes
+// arrive instead of sleeping a fixed amount of time.  We read whatever the Bus Pirate has sent (up to the free space in
+// the ring), so we may end up with more than count bytes ... they stay in the ring for the next response.  timeout is
+// the deadline in milliseconds.  Returns 0 or -1 on error (errno is ETIMEDOUT if nothing came in time).  This one
+// doesn't count timeouts ... bpfill does, ringwait is for waits where no answer is an answer (the mode probe).
+static int ringwait (struct buspirate *bp, int count, int timeout) {
+
+  struct pollfd pollopts;
+  struct timespec now, deadline;
+  int result, remaining, offset, space;
+
+  if (count > RINGSIZE) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec = deadline.tv_sec + timeout / 1000;
+  deadline.tv_nsec = deadline.tv_nsec + (timeout % 1000) * 1000000L;
+
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec = deadline.tv_nsec - 1000000000L;
+  }
+
+  pollopts.fd = bp->fd;
+  pollopts.events = POLLIN;
+
+  while (RINGCOUNT (&bp->rx) < count) {
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    remaining = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+
+    if (remaining <= 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    result = poll (&pollopts, 1, remaining);
+    bp->stats.polls++;
+
+    if ((result == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if (result == -1) {
+      return -1;
+    }
+    if (result == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    // Read straight into the ring ... as much as fits before the end of the buffer (we'll get the rest next time around)
+    offset = bp->rx.head & (RINGSIZE - 1);
+    space = RINGSIZE - RINGCOUNT (&bp->rx);
+
+    if (space > RINGSIZE - offset) {
+      space = RINGSIZE - offset;
+    }
+
+    result = read (bp->fd, &bp->rx.data[offset], space);
+    bp->stats.reads++;
+
+    if ((result == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
+      continue;
+    }
+    if (result == -1) {
+      return -1;
+    }
+    if (result == 0) {		// poll said there was data but there isn't ... the device went away
+      errno = EIO;
+      return -1;
+    }
+
+    bp->rx.head = bp->rx.head + result;
+    bp->stats.bytesread = bp->stats.bytesread + result;
+  }
+
+  return 0;
+}
+
+// ringwait for a response that has to come.  timeout is generous so that a slow USB port (docking station!) still
+// works.  Returns 0 or -1 on error.  A timeout sets errno to ETIMEDOUT so that perror reports it.
+int bpfill (struct buspirate *bp, int count, int timeout) {
+
+  if (ringwait (bp, count, timeout) == -1) {
+    if (errno == ETIMEDOUT) {
+      bp->stats.timeouts++;
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+// Wait for exactly count bytes from the Bus Pirate and copy them into buffer.  Use this for short responses ... the
+// command stream parser reads big responses right out of the ring.  Returns count or -1 on error.
+int bpreceive (struct buspirate *bp, char *buffer, int count, int timeout) {
+
+  int i;
+
+  if (bpfill (bp, count, timeout) == -1) {
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    buffer[i] = RINGBYTE (&bp->rx, i);
+  }
+
+  bp->rx.tail = bp->rx.tail + count;
+
+  return count;
+}
+
+// Read whatever the Bus Pirate has sent so far into the receive ring without waiting.  This is for event loops (like
+// the epoll loop in bus_pirate_station.c) that already know the port is readable ... VMIN and VTIME are 0 (see
+// setupport) so the read never blocks.  Returns the number of bytes read (0 if there was nothing) or -1 on error.
+int bpreadavailable (struct buspirate *bp) {
+
+  int result, offset, space;
+
+  offset = bp->rx.head & (RINGSIZE - 1);
+  space = RINGSIZE - RINGCOUNT (&bp->rx);
+
+  if (space > RINGSIZE - offset) {
+    space = RINGSIZE - offset;
+  }
+
+  if (space == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  result = read (bp->fd, &bp->rx.data[offset], space);
+  bp->stats.reads++;
+
+  if ((result == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
+    return 0;
+  }
+  if (result == -1) {
+    return -1;
+  }
+
+  bp->rx.head = bp->rx.head + result;
+  bp->stats.bytesread = bp->stats.bytesread + result;
+
+  return result;
+}
+
+// Throw away everything the Bus Pirate sends until it has been quiet for timeout milliseconds (and anything still in the
+// ring).  Use this for output we don't care about and can't predict the length of ... like the hardware and firmware
+// version it prints after a reset.
+void bpdrain (struct buspirate *bp, int timeout) {
+
+  struct pollfd pollopts;
+  char buffer[256];
+  int result;
+
+  bp->rx.tail = bp->rx.head;
+  pollopts.fd = bp->fd;
+  pollopts.events = POLLIN;
+
+  for (;;) {
+    result = poll (&pollopts, 1, timeout);
+    bp->stats.polls++;
+
+    if (result <= 0) {
+      break;
+    }
+
+    result = read (bp->fd, buffer, sizeof (buffer));
+    bp->stats.reads++;
+
+    if (result <= 0) {
+      break;
+    }
+
+    bp->stats.bytesread = bp->stats.bytesread + result;
+  }
+}
+
+// Find length bytes of pattern in the receive ring.  Returns the offset (from the tail) of the first match or -1.
+int ringfind (struct ringbuffer *ring, const char *pattern, int length) {
+
+  int i, j;
+
+  for (i = 0; i + length <= RINGCOUNT (ring); i++) {
+    for (j = 0; (j < length) && (RINGBYTE (ring, i + j) == pattern[j]); j++);
+
+    if (j == length) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Send nulls one at a time until "BBIO1" shows up in the receive ring (or we've sent NULLCOUNT of them).  User mode
+// wants 20 nulls in a row (fewer if a program died halfway through the handshake), binary, SPI and I2C mode answer the
+// first one.  We don't wait for an answer between nulls ... each one goes out on its own (tcdrain) and we look at
+// whatever has come back before sending the next.  The ones that went out before the answer got here each get a
+// "BBIO1" of their own, so the caller has to skip those.  Returns 0 or -1 on error.
+int bpsendnulls (struct buspirate *bp) {
+
+  int nulls;
+
+  for (nulls = 0; (nulls < NULLCOUNT) && (ringfind (&bp->rx, "BBIO1", 5) == -1); nulls++) {
+    if ((bpsend (bp, "\0", 1) == -1) || (tcdrain (bp->fd) == -1) || (bpreadavailable (bp) == -1)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Put the Bus Pirate in binary mode, I2C mode and turn on power and pullups.  Whatever is still waiting on the port
+// (a program that died halfway leaves its responses behind) is thrown away first.
+//
+// With probe set in bp (-k ... somebody probably left the Bus Pirate in binary I2C mode) ask first with MODEPROBE (\1
+// and \x4C).  In I2C mode that answers "I2C1" (\1) and 0x1 (power and pullups) and we're done in one round trip.  Any
+// other answer (or none within PROBETIMEOUT) gets drained and we do it the long way.  We don't probe without -k ...
+// in user mode the probe only finds out by timing out.
+//
+// The long way:  nulls one at a time until "BBIO1" comes back (see bpsendnulls), then I2C mode and power (I2CRESUME).
+// Bus Pirate answers "BBIO1" for every extra null, then "I2C1" and 0x1 (a wrong answer gets one more try after the
+// leftovers stop).  Returns 0, -1 on an I/O error or 1 if the Bus Pirate didn't answer right.
+int bpentermode (struct buspirate *bp) {
+
+  long long start;
+  int found, tries;
+
+  start = bpmicros ();
+  bpdrain (bp, 0);
+
+  if (bp->probe) {
+    if (bpsend (bp, MODEPROBE, 2) == -1) {
+      return -1;
+    }
+
+    if (ringwait (bp, 5, PROBETIMEOUT) == 0) {
+      if (ringfind (&bp->rx, "I2C1\1", 5) == 0) {
+        bp->rx.tail = bp->rx.tail + 5;
+        bprecord (bp, STATMODE, start);
+        return 0;
+      }
+    }
+    else if (errno != ETIMEDOUT) {	// No answer is an answer here (user mode) ... not a timeout
+      return -1;
+    }
+
+    bpdrain (bp, DRAINTIMEOUT);		// "SPI1" (binary mode) or something we don't know ... the nulls sort it out
+  }
+
+  for (tries = 0; ; tries++) {
+    if (bpsendnulls (bp) == -1) {
+      return -1;
+    }
+
+    // Wait for the "BBIO1" if the last null is still on its way.  Anything in front of it is left over from whatever
+    // mode the Bus Pirate was in.
+    while ((found = ringfind (&bp->rx, "BBIO1", 5)) == -1) {
+      if (bpfill (bp, RINGCOUNT (&bp->rx) + 1, RESPONSETIMEOUT) == -1) {
+        return -1;
+      }
+    }
+
+    bp->rx.tail = bp->rx.tail + found + 5;
+
+    if (bpsend (bp, I2CRESUME, 2) == -1) {
+      return -1;
+    }
+
+    do {
+      if (bpfill (bp, 5, RESPONSETIMEOUT) == -1) {
+        return -1;
+      }
+
+      found = (ringfind (&bp->rx, "BBIO1", 5) == 0);
+
+      if (found) {
+        bp->rx.tail = bp->rx.tail + 5;	// A null that went out before we saw the first "BBIO1"
+      }
+    } while (found);
+
+    // The "BBIO1" we went by can be a stale one (a program that died right after MODEEXIT ... the version banner is
+    // still coming).  Wait for the leftovers to stop and try once more before we give up.
+    if ((ringfind (&bp->rx, "I2C1\1", 5) == 0) || (tries == 1)) {
+      break;
+    }
+
+    bpdrain (bp, DRAINTIMEOUT);
+  }
+
+  bprecord (bp, STATMODE, start);
+
+  if ((RINGBYTE (&bp->rx, 0) != 'I') || (RINGBYTE (&bp->rx, 1) != '2') || (RINGBYTE (&bp->rx, 2) != 'C') ||
+      (RINGBYTE (&bp->rx, 3) != '1')) {
+    bp->rx.tail = bp->rx.head;
+    bp->error = "Could not enable I2C mode on Bus Pirate";
+    return 1;
+  }
+  if (RINGBYTE (&bp->rx, 4) != 1) {
+    bp->rx.tail = bp->rx.head;
+    bp->error = "Could not enable peripherals mode on Bus Pirate";
+    return 1;
+  }
+
+  bp->rx.tail = bp->rx.tail + 5;
+
+  return 0;
+}
+
+// Disable I2C mode and binary mode ... put the Bus Pirate back into user mode.  Bus Pirate will answer with "BBIO1" and
+// 0x1.  Once back in user mode, the Bus Pirate will print hardware and firmware version ... read this output so it
+// isn't left waiting for the next program that opens the port.  Returns 0, -1 on an I/O error or 1 if the Bus Pirate
+// didn't answer right.
+int bpexitmode (struct buspirate *bp) {
+
+  long long start;
+  char response[6];
+
+  start = bpmicros ();
+
+  if (bpsend (bp, MODEEXIT, 2) == -1) {
+    return -1;
+  }
+  if (bpreceive (bp, response, 6, RESPONSETIMEOUT) == -1) {
+    return -1;
+  }
+
+  bprecord (bp, STATRESET, start);
+
+  if (strncmp ("BBIO1", response, 5) != 0) {
+    bp->error = "Could not disable I2C mode on Bus Pirate";
+    return 1;
+  }
+  if (response[5] != 1) {
+    bp->error = "Could not reset Bus Pirate to user mode";
+    return 1;
+  }
+
+  bpdrain (bp, BANNERTIMEOUT);
+
+  return 0;
+}
+
+// Something went wrong ... do our best to leave the Bus Pirate in a sane state (send a stop bit, leave I2C mode, reset
+// to user mode) and close the port.  Don't check any of the answers.
+void bpabort (struct buspirate *bp) {
+
+  if (bp->fd != -1) {
+    bpsend (bp, STOPWRITE, 1);
+    bpsend (bp, MODEEXIT, 2);
+  }
+
+  bpclose (bp);
+}
+
+// Tell the user what went wrong.  result is what the failed function returned:  -1 is an I/O error (perror with what),
+// 1 is an error from the Bus Pirate or the EEPROM (the error in bp and the EEPROM address, if we know it).
+void bpreport (struct buspirate *bp, int result, char *what) {
+
+  if ((result == -1) && (errno != 0)) {
+    fprintf (stderr, "%s - %s\n", what, strerror (errno));
+  }
+  else if ((bp->error != NULL) && (bp->erroraddress != -1)) {
+    printf ("%s (address %d)\n", bp->error, bp->erroraddress);
+  }
+  else if (bp->error != NULL) {
+    puts (bp->error);
+  }
+  else {
+    puts (what);
+  }
+}
+
+// A program has to give up (it has already told the user why) ... leave the Bus Pirate in a sane state, write the JSON
+// summary (if there's a statsfile) and exit with code.
+void bpquit (struct buspirate *bp, int code, char *statsfile) {
+
+  bpabort (bp);
+
+  if (statsfile != NULL) {
+    bpwritestats (bp, statsfile);
+  }
+
+  exit (code);
+}
+
+// Something went wrong in one of the programs ... tell the user (see bpreport) and quit (see bpquit).  A serial port
+// that never opened exits with 1, -1 (I/O error) with 3 and anything else (Bus Pirate or EEPROM error) with 4.
+void bpfail (struct buspirate *bp, int result, char *what, char *statsfile) {
+
+  if (bp->fd == -1) {
+    fprintf (stderr, "Unable to open %s - %s\n", bp->device, strerror (errno));
+    exit (1);
+  }
+
+  bpreport (bp, result, what);
+  bpquit (bp, (result == -1) ? 3 : 4, statsfile);
+}
+
+// Set the I2C bus speed.  speed is 0 - 3 for 5, 50, 100 or 400 kHz (see speeds) ... it goes in the low 2 bits of the
+// speed command.  Bus Pirate will answer with 0x1.  Returns 0, -1 on an I/O error or 1 if the Bus Pirate didn't like it.
+int bpsetspeed (struct buspirate *bp, int speed) {
+
+  long long start;
+  char command[1], response[1];
+
+  command[0] = SPEEDCMD | speed;
+  start = bpmicros ();
+
+  if (bpsend (bp, command, 1) == -1) {
+    return -1;
+  }
+  if (bpreceive (bp, response, 1, RESPONSETIMEOUT) == -1) {
+    return -1;
+  }
+
+  bprecord (bp, STATSPEED, start);
+
+  if (response[0] != 1) {
+    bp->error = "Could not set I2C speed on Bus Pirate";
+    return 1;
+  }
+
+  bp->speed = speed;
+
+  return 0;
+}
+
+// Check that the bus works at the current speed.  Read the first PROBESIZE bytes of the EEPROM twice with a sequential
+// read and make sure every start bit, bulk write, ACK and stop bit comes back right and that both reads got the same
+// data.  Returns 0, -1 on an I/O error or 1 if something was wrong.
+int bpprobespeed (struct buspirate *bp) {
+
+  char data[2][PROBESIZE];
+  int result, i;
+
+  for (i = 0; i < 2; i++) {
+    streamreset (&bp->stream);
+    streamread (&bp->stream, 0, data[i], PROBESIZE);
+    result = streamsend (bp, &bp->stream, RESPONSETIMEOUT);
+
+    if (result == -1) {
+      return -1;
+    }
+    if (result < bp->stream.count) {
+      bp->error = bp->stream.error;
+      bpdrain (bp, BANNERTIMEOUT);	// Throw away the rest of the bad response
+      return 1;
+    }
+  }
+
+  if (memcmp (data[0], data[1], PROBESIZE) != 0) {
+    bp->error = "Readback probe got different data twice";
+    return 1;
+  }
+
+  return 0;
+}
+
+// Find the fastest I2C speed that works.  Start at 400 kHz (the 24LC08B is rated for it) and drop to the next slower
+// speed until the readback probe passes.  Returns the speed (0 - 3) or -1 if nothing works (errno is set if it was an
+// I/O error ... otherwise it's 0).
+int bpautospeed (struct buspirate *bp) {
+
+  int speed, result;
+
+  for (speed = 3; speed >= 0; speed--) {
+    result = bpsetspeed (bp, speed);
+
+    if (result == 0) {
+      result = bpprobespeed (bp);
+    }
+    if (result == -1) {
+      return -1;
+    }
+    if (result == 0) {
+      return speed;
+    }
+  }
+
+  bp->error = "Could not find a working I2C speed";
+  errno = 0;
+
+  return -1;
+}
+
+// Turn the -s option into a speed (0 - 3), SPEEDAUTO for "auto" or -1 if we don't know it
+int parsespeed (char *option) {
+
+  int speed;
+
+  if (strcmp (option, "auto") == 0) {
+    return SPEEDAUTO;
+  }
+
+  for (speed = 0; speed < 4; speed++) {
+    if (atoi (option) == speeds[speed]) {
+      return speed;
+    }
+  }
+
+  return -1;
+}
+
+// Find out if the firmware supports the I2C "write then read" command (0x08).  Newer firmware does the whole start,
+// write, read, ACK/NACK, stop sequence on its own and hands back up to 4096 bytes in one reply, which lets us read a
+// complete block in a single round trip.  Probe it with an empty request (write 0 bytes, read 0 bytes):
+//  - Supported:  the Bus Pirate sends a start and a stop and answers 0x1
+//  - Not supported:  the 0x8 is ignored and the null bytes that follow it drop us back into bitbang mode ... the
+//    Bus Pirate answers with "BBIO1" instead.  Throw away the rest of the output and get back into I2C mode (and turn
+//    the power and pullups back on and set the speed again).
+// Sets bulkread in bp.  Returns 0, -1 on an I/O error or 1 if we couldn't get back into I2C mode.
+int bpprobebulkread (struct buspirate *bp) {
+
+  long long start;
+  char response[5];
+
+  start = bpmicros ();
+
+  if (bpsend (bp, BULKREADPROBE, 5) == -1) {
+    return -1;
+  }
+
+  if ((bpreceive (bp, response, 1, RESPONSETIMEOUT) == 1) && (response[0] == 1)) {
+    bprecord (bp, STATPROBE, start);
+    bp->bulkread = 1;
+    return 0;
+  }
+
+  bp->bulkread = 0;
+  bpdrain (bp, BANNERTIMEOUT);
+
+  if (bpsend (bp, I2CRESUME, 2) == -1) {
+    return -1;
+  }
+  if (bpreceive (bp, response, 5, RESPONSETIMEOUT) == -1) {
+    return -1;
+  }
+
+  if ((strncmp ("I2C1", response, 4) != 0) || (response[4] != 1)) {
+    bp->error = "Could not re-enable I2C mode on Bus Pirate";
+    return 1;
+  }
+
+  if (bp->speed != SPEEDDEFAULT) {
+    return bpsetspeed (bp, bp->speed);
+  }
+
+  return 0;
+}
+
+// Everything the programs do before the real work:  open the serial port, talk to profile, put the Bus Pirate in I2C
+// mode (probe first if it's probably still there ... see bpentermode), find out if it can do "write then read" and set
+// the I2C speed (SPEEDAUTO finds the fastest one that works, SPEEDDEFAULT leaves the firmware default alone).  Returns
+// 0, -1 on an I/O error or 1 if the Bus Pirate didn't answer right.  what says which step went wrong (for bpreport or
+// bpfail) ... if it was the serial port, fd in bp is -1.
+int bpstart (struct buspirate *bp, char *port, const struct eepromprofile *profile, int speed, int probe,
+             char **what) {
+
+  int result;
+
+  *what = "Unable to open the serial port";
+
+  if (bpopen (bp, port) == -1) {
+    return -1;
+  }
+
+  bpsetprofile (bp, profile);
+  bp->probe = probe;
+  *what = "Could not enter I2C mode on Bus Pirate";
+  result = bpentermode (bp);
+
+  if (result != 0) {
+    return result;
+  }
+
+  *what = "Could not send write then read probe to Bus Pirate";
+  result = bpprobebulkread (bp);
+
+  if (result != 0) {
+    return result;
+  }
+
+  *what = "Could not set I2C speed on Bus Pirate";
+
+  if (speed == SPEEDAUTO) {
+    speed = bpautospeed (bp);
+
+    if (speed == -1) {
+      return -1;
+    }
+
+    fprintf (stderr, "I2C speed:  %d kHz\n", speeds[speed]);
+  }
+  else if (speed != SPEEDDEFAULT) {
+    return bpsetspeed (bp, speed);
+  }
+
+  return 0;
+}
+
+// Microseconds since some point in the past (CLOCK_MONOTONIC)
+long long bpmicros (void) {
+
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Record a round trip of the given command type that started at start (see bpmicros) and just finished
+void bprecord (struct buspirate *bp, int type, long long start) {
+
+  struct latency *latency;
+  long long elapsed;
+  int bucket;
+
+  latency = &bp->stats.commands[type];
+  elapsed = bpmicros () - start;
+
+  for (bucket = 0; (bucket < STATBUCKETS - 1) && (elapsed >> (bucket + 1)); bucket++);
+
+  latency->count++;
+  latency->total = latency->total + elapsed;
+  latency->buckets[bucket]++;
+
+  if (elapsed > latency->max) {
+    latency->max = elapsed;
+  }
+}
+
+// Write everything in stats as JSON to the file name ("-" is stdout).  The histograms only list the buckets that got
+// something ... "le" is the upper bound of the bucket in usec.  Tells you whether a slow run is USB latency (every
+// command type is slow), EEPROM write cycles (ack_poll is slow) or us (elapsed is much bigger than the sum of the
+// commands).  Returns 0 or -1 on error.
+int bpwritestats (struct buspirate *bp, char *name) {
+
+  struct bpstats *stats;
+  struct latency *latency;
+  FILE *out;
+  int i, j, first;
+
+  stats = &bp->stats;
+  out = (strcmp (name, "-") == 0) ? stdout : fopen (name, "w");
+
+  if (out == NULL) {
+    return -1;
+  }
+
+  fprintf (out, "{\n  \"device\": \"%s\",\n  \"elapsed_us\": %lld,\n", bp->device, bpmicros () - stats->started);
+  fprintf (out, "  \"roundtrips\": %ld,\n", bp->roundtrips);
+  fprintf (out, "  \"syscalls\": {\"read\": %ld, \"write\": %ld, \"poll\": %ld},\n", stats->reads, stats->writes,
+           stats->polls);
+  fprintf (out, "  \"bytes\": {\"read\": %lld, \"written\": %lld},\n", stats->bytesread, stats->byteswritten);
+  fprintf (out, "  \"shadow\": {\"hits\": %ld, \"misses\": %ld, \"generation\": %u},\n", stats->shadowhits,
+           stats->shadowmisses, bp->shadow.generation);
+  fprintf (out, "  \"timeouts\": %ld,\n  \"commands\": {", stats->timeouts);
+
+  for (i = 0; i < STATTYPES; i++) {
+    latency = &stats->commands[i];
+    fprintf (out, "%s\n    \"%s\": {\"count\": %ld, \"total_us\": %lld, \"max_us\": %lld, \"mean_us\": %lld, "
+             "\"histogram\": [",
+             (i == 0) ? "" : ",", statnames[i], latency->count, latency->total, latency->max,
+             (latency->count > 0) ? latency->total / latency->count : 0);
+
+    for (j = 0, first = 1; j < STATBUCKETS; j++) {
+      if (latency->buckets[j] > 0) {
+        fprintf (out, "%s{\"le\": %lld, \"count\": %ld}", (first) ? "" : ", ", (2LL << j) - 1, latency->buckets[j]);
+        first = 0;
+      }
+    }
+
+    fprintf (out, "]}");
+  }
+
+  fprintf (out, "\n  }\n}\n");
+
+  if (out == stdout) {
+    fflush (out);
+    return 0;
+  }
+
+  return fclose (out);
+}
+
+// Figure out the image file format from its name:  .hex or .ihx is Intel HEX, anything else is raw binary
+int imageformat (char *name) {
+
+  char *extension;
+
+  extension = strrchr (name, '.');
+
+  if ((extension != NULL) && ((strcasecmp (extension, ".hex") == 0) || (strcasecmp (extension, ".ihx") == 0))) {
+    return IMAGEHEX;
+  }
+
+  return IMAGERAW;
+}
+
+// Value of the 2 hex digits at text or -1 if they aren't hex digits
+static int hexbyte (const char *text) {
+
+  if (!isxdigit ((unsigned char) text[0]) || !isxdigit ((unsigned char) text[1])) {
+    return -1;
+  }
+
+  return (((isdigit ((unsigned char) text[0])) ? text[0] - '0' : (tolower (text[0]) - 'a' + 10)) << 4) |
+         ((isdigit ((unsigned char) text[1])) ? text[1] - '0' : (tolower (text[1]) - 'a' + 10));
+}
+
+// Parse the Intel HEX records in text (length bytes) into data.  Handles data (00), end of file (01), extended segment
+// address (02) and extended linear address (04) records and ignores start address records (03, 05).  Every record's
+// checksum has to be right and every byte has to land inside the EEPROM.  first is set to the lowest and length to
+// one past the highest address we got data for.  Returns 0 or 1 if the file is bad (error tells you why).  A file with
+// holes between those addresses is fine, but error says how many bytes the file didn't fill in (they get written too
+// ... whatever is in data).
+static int hexload (const char *text, long size, char *data, int datasize, int *first, int *length,
+                    const char **error) {
+
+  static char message[80];
+  unsigned char filled[EEPROMMAX / 8];	// Bit for every byte a data record set (datasize is never bigger)
+  long position;
+  long long base, where;			// 64 bits ... an extended linear address shifted up 16 doesn't fit an int
+  int line, count, type, address, sum, value, i, gaps;
+
+  position = 0;
+  line = 0;
+  base = 0;
+  *first = datasize;
+  *length = 0;
+  bzero (filled, sizeof (filled));
+
+  while (position < size) {
+    if (isspace ((unsigned char) text[position])) {
+      line = line + (text[position] == '\n');
+      position++;
+      continue;
+    }
+
+    snprintf (message, sizeof (message), "Bad Intel HEX record on line %d", line + 1);
+    *error = message;
+
+    // :ccaaaatt ... dd ... ss
+    if ((text[position] != ':') || (size - position < 11)) {
+      return 1;
+    }
+
+    count = hexbyte (&text[position + 1]);
+
+    if ((count < 0) || (size - position < 11 + 2 * count)) {
+      return 1;
+    }
+
+    sum = 0;
+
+    for (i = 0; i < count + 5; i++) {
+      value = hexbyte (&text[position + 1 + 2 * i]);
+
+      if (value < 0) {
+        return 1;
+      }
+
+      sum = sum + value;
+    }
+
+    if ((sum & 0xFF) != 0) {
+      snprintf (message, sizeof (message), "Intel HEX checksum error on line %d", line + 1);
+      return 1;
+    }
+
+    address = (hexbyte (&text[position + 3]) << 8) | hexbyte (&text[position + 5]);
+    type = hexbyte (&text[position + 7]);
+
+    if (type == 0) {
+      for (i = 0; i < count; i++) {
+        where = base + address + i;
+
+        if ((where < 0) || (where >= datasize) || (where >= EEPROMMAX)) {
+          snprintf (message, sizeof (message), "Intel HEX data past the end of the EEPROM on line %d", line + 1);
+          return 1;
+        }
+
+        data[where] = hexbyte (&text[position + 9 + 2 * i]);
+        filled[where / 8] = filled[where / 8] | (1 << (where % 8));
+
+        if (where < *first) {
+          *first = where;
+        }
+        if (where + 1 > *length) {
+          *length = where + 1;
+        }
+      }
+    }
+    else if (type == 1) {
+      break;
+    }
+    else if ((type == 2) || (type == 4)) {
+      if (count != 2) {
+        return 1;
+      }
+
+      value = (hexbyte (&text[position + 9]) << 8) | hexbyte (&text[position + 11]);
+      base = (type == 2) ? (long long) value << 4 : (long long) value << 16;
+    }
+
+    position = position + 11 + 2 * count;
+  }
+
+  *error = NULL;
+
+  if (*length == 0) {
+    *first = 0;
+  }
+
+  for (i = *first, gaps = 0; i < *length; i++) {
+    gaps = gaps + !(filled[i / 8] & (1 << (i % 8)));
+  }
+
+  if (gaps > 0) {
+    snprintf (message, sizeof (message), "Intel HEX file skips %d of %d bytes (written as 0xFF)", gaps,
+              *length - *first);
+    *error = message;
+  }
+
+  return 0;
+}
+
+// Load an image file (raw binary or Intel HEX ... see imageformat) into data, which holds size bytes.  The file is
+// memory mapped and parsed right where it is.  A raw binary file goes at data[0].  Intel HEX records go where their
+// addresses say (data[0] is address 0) and the bytes the file doesn't mention are left alone, so fill data with 0xFF
+// (a blank EEPROM) first.  first is set to the first address the file has data for (always 0 for raw binary) and
+// length to one past the last one.  Returns 0, -1 on an I/O error (errno tells you what) or 1 if the file is bad
+// (error tells you why).  If it returns 0 with an error, the file is fine but has holes ... warn about it, the holes
+// get written over like everything else.
+int imageload (char *name, char *data, int size, int *first, int *length, const char **error) {
+
+  struct stat status;
+  char *text;
+  int fd, result;
+
+  *first = 0;
+  *length = 0;
+  *error = NULL;
+  fd = open (name, O_RDONLY);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (fstat (fd, &status) == -1) {
+    close (fd);
+    return -1;
+  }
+
+  if (status.st_size == 0) {		// Nothing to map
+    close (fd);
+    return 0;
+  }
+
+  text = mmap (NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (text == MAP_FAILED) {
+    return -1;
+  }
+
+  result = 0;
+
+  if (imageformat (name) == IMAGEHEX) {
+    result = hexload (text, status.st_size, data, size, first, length, error);
+  }
+  else if (status.st_size > size) {
+    *error = "Image is bigger than the EEPROM";
+    result = 1;
+  }
+  else {
+    memcpy (data, text, status.st_size);
+    *length = status.st_size;
+  }
+
+  munmap (text, status.st_size);
+
+  return result;
+}
+
+// Open an image file for writing ("-" is stdout).  Returns NULL on error.
+FILE *imagecreate (char *name) {
+
+  if (strcmp (name, "-") == 0) {
+    return stdout;
+  }
+
+  return fopen (name, "wb");
+}
+
+// Write length bytes that we read from EEPROM address to the image file.  Call it for every block as soon as it has
+// been read ... the file fills up while we read.  Intel HEX gets a data record for every HEXRECORD bytes.  Returns 0 or
+// -1 on error.
+int imagewrite (FILE *out, int format, int address, char *data, int length) {
+
+  int i, j, count, sum;
+
+  if (format == IMAGERAW) {
+    return (fwrite (data, 1, length, out) == (size_t) length) ? 0 : -1;
+  }
+
+  for (i = 0; i < length; i = i + count) {
+    count = (length - i > HEXRECORD) ? HEXRECORD : length - i;
+    sum = count + (((address + i) >> 8) & 0xFF) + ((address + i) & 0xFF);
+    fprintf (out, ":%02X%04X00", count, (address + i) & 0xFFFF);
+
+    for (j = 0; j < count; j++) {
+      fprintf (out, "%02X", (unsigned char) data[i + j]);
+      sum = sum + (unsigned char) data[i + j];
+    }
+
+    fprintf (out, "%02X\n", (-sum) & 0xFF);
+  }
+
+  return (fflush (out) == 0) ? 0 : -1;
+}
+
+// Finish the image file (Intel HEX gets its end of file record) and close it.  Returns 0 or -1 on error.
+int imageclose (FILE *out, int format) {
+
+  if (format == IMAGEHEX) {
+    fprintf (out, ":00000001FF\n");
+  }
+
+  if (out == stdout) {
+    return (fflush (out) == 0) ? 0 : -1;
+  }
+
+  return fclose (out);
+}
+
+// A framed image starts with a small header so that binary data (new lines and all) can be stored and the reader knows
+// exactly how much to read:
+//  - FRAMEMAGIC ("BP")
+//  - length of the data:  high byte, low byte
+//  - CRC-16/CCITT of the data (see crc16):  high byte, low byte
+// The data follows right after the header.
+//
+// Turn the length bytes of data at the start of buffer into a framed image ... the data moves up to make room for the
+// header.  buffer holds size bytes.  Returns the length of the framed image or -1 if it doesn't fit.
+int framebuild (char *buffer, int length, int size) {
+
+  int crc;
+
+  if (length + FRAMEHEADERSIZE > size) {
+    return -1;
+  }
+
+  memmove (&buffer[FRAMEHEADERSIZE], buffer, length);
+  crc = crc16 (&buffer[FRAMEHEADERSIZE], length);
+  memcpy (buffer, FRAMEMAGIC, 2);
+  buffer[2] = length >> 8;
+  buffer[3] = length & 0xFF;
+  buffer[4] = crc >> 8;
+  buffer[5] = crc & 0xFF;
+
+  return length + FRAMEHEADERSIZE;
+}
+
+// Check a framed image header (FRAMEHEADERSIZE bytes) and get the length and CRC of the data out of it.  Returns 0 or
+// 1 if it isn't a framed image header.
+int frameparse (char *header, int *length, int *crc) {
+
+  if (memcmp (header, FRAMEMAGIC, 2) != 0) {
+    return 1;
+  }
+
+  *length = ((unsigned char) header[2] << 8) | (unsigned char) header[3];
+  *crc = ((unsigned char) header[4] << 8) | (unsigned char) header[5];
+
+  return 0;
+}
+
+// Get the data the writers write:  the image file (raw binary or Intel HEX ... see imageload) or, without one, a line
+// typed in on the terminal.  Bytes an Intel HEX file doesn't mention are 0xFF, just like a blank EEPROM.  With framed
+// (-H) the data gets the frame header (see framebuild).  buffer holds size + 1 bytes (room for the \0 fgets adds).
+// Returns the number of bytes to write ... a bad file or data that doesn't fit gets a message and exits with 1.
+int imageinput (char *imagefile, char *buffer, int size, int framed) {
+
+  const char *error;
+  int result, first, length;
+
+  if (imagefile != NULL) {
+    memset (buffer, 0xFF, size);
+    result = imageload (imagefile, buffer, size, &first, &length, &error);
+
+    if (result == -1) {
+      fprintf (stderr, "Could not read %s - %s\n", imagefile, strerror (errno));
+      exit (1);
+    }
+    if (result == 1) {
+      printf ("%s:  %s\n", imagefile, error);
+      exit (1);
+    }
+    if (error != NULL) {
+      fprintf (stderr, "Warning:  %s:  %s\n", imagefile, error);
+    }
+    if (first > 0) {		// The writers start at 0
+      fprintf (stderr, "Warning:  %s:  no data below address %d (written as 0xFF)\n", imagefile, first);
+    }
+  }
+  else {
+    printf ("Enter to end (%d chars max)> ", size);
+    fgets (buffer, size + 1, stdin);
+    length = strlen (buffer);
+  }
+
+  if (framed) {
+    length = framebuild (buffer, length, size);
+
+    if (length == -1) {
+      printf ("Too much data for a framed image (%d bytes max)\n", size - FRAMEHEADERSIZE);
+      exit (1);
+    }
+  }
+
+  return length;
+}
+
+// Find the EEPROM profile called name (case doesn't matter).  Returns NULL if we don't know it.
+const struct eepromprofile *findprofile (char *name) {
+
+  int i;
+
+  for (i = 0; i < PROFILES; i++) {
+    if (strcasecmp (name, profiles[i].name) == 0) {
+      return &profiles[i];
+    }
+  }
+
+  return NULL;
+}
+
+// Look up the EEPROM for -e (see findprofile).  One we don't know is a usage error ... say so and exit with 1.
+const struct eepromprofile *parseprofile (char *name) {
+
+  const struct eepromprofile *profile;
+
+  profile = findprofile (name);
+
+  if (profile == NULL) {
+    fprintf (stderr, "Unknown EEPROM:  %s\n", name);
+    exit (1);
+  }
+
+  return profile;
+}
+
+// Talk to a different EEPROM from now on.  The shadow copy is for the old one, so forget all of it.
+void bpsetprofile (struct buspirate *bp, const struct eepromprofile *profile) {
+
+  bp->profile = profile;
+  bp->stream.profile = profile;
+  bzero (bp->shadow.stamps, sizeof (bp->shadow.stamps));
+}
+
+// Number of ACK polls that cover the EEPROM's longest write cycle
+int profilepolls (const struct eepromprofile *profile) {
+
+  return (profile->writecycle * ACKPOLLSPERMS + 999) / 1000;
+}
+
+// Map an EEPROM address to the device write address.  With a single word address byte, the EEPROM is really blocks of
+// 256 bytes and the block number (the address bits above the word address) goes in bits 1 - 3 of the device address
+// ... on the 24LC08B that's 0xA0, 0xA2, 0xA4 or 0xA6.  Parts with 2 word address bytes are always at 0xA0 (we leave
+// the chip select pins alone).  Add 1 to get the device read address.
+int deviceaddress (const struct eepromprofile *profile, int address) {
+
+  return 0xA0 | (((address >> (8 * profile->words)) & ((1 << profile->blockbits) - 1)) << 1);
+}
+
+// Plan the next page write.  Given the EEPROM address we're writing to and the number of bytes we still have to write,
+// return the number of bytes that go in this transaction:  the rest of the page or the rest of the data, whichever is
+// smaller.  An aligned start gets a full page; an unaligned start only gets the bytes up to the end of its page so that
+// the write never wraps around inside the page.
+int planwrite (const struct eepromprofile *profile, int address, int count) {
+
+  int length;
+
+  length = profile->pagesize - (address % profile->pagesize);
+
+  if (length > count) {
+    length = count;
+  }
+
+  return length;
+}
+
+// CRC-16/CCITT (polynomial 0x1021, starts at 0xFFFF) of length bytes.  This is what every program reports and checks
+// (frames, the journal, verify).  Unlike a sum mod 255 it can tell erased (0xFF) data from zeroed (0x00) data, and it
+// catches every burst of up to 16 bad bits.
+int crc16 (char *data, int length) {
+
+  int i, j, crc;
+
+  crc = 0xFFFF;
+
+  for (i = 0; i < length; i++) {
+    crc = crc ^ ((unsigned char) data[i] << 8);
+
+    for (j = 0; j < 8; j++) {
+      crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+    }
+  }
+
+  return crc;
+}
+
+// Empty the command stream so we can start a new batch
+void streamreset (struct commandstream *stream) {
+
+  stream->commandlength = 0;
+  stream->count = 0;
+  stream->checked = 0;
+  stream->responselength = 0;
+  stream->failed = -1;
+  stream->failedoffset = 0;
+  stream->error = NULL;
+}
+
+// Add a transaction to the command stream.  Returns a pointer to it or NULL if the stream doesn't have room for
+// commandlength more command bytes and responselength more response bytes.
+struct transaction *streamadd (struct commandstream *stream, int type, int commandlength, int responselength) {
+
+  struct transaction *transaction;
+
+  if ((stream->count == MAXTRANSACTIONS) || (stream->commandlength + commandlength >= STREAMSIZE) ||
+      (stream->responselength + responselength > STREAMSIZE)) {
+    return NULL;
+  }
+
+  transaction = &stream->transactions[stream->count++];
+  transaction->type = type;
+  transaction->address = 0;
+  transaction->length = 0;
+  transaction->data = NULL;
+  transaction->responsestart = stream->responselength;
+  transaction->responselength = responselength;
+  stream->responselength = stream->responselength + responselength;
+
+  return transaction;
+}
+
+// Queue a page write:  start bit, bulk write commands for the device write address, write address (1 or 2 bytes, see
+// struct eepromprofile) and data bytes, stop bit.  The address and data are split into bulk write commands of up to
+// 16 bytes each.  The bulk write command doesn't send a start or stop bit, so the EEPROM sees all of them as a single
+// page write.  Use planwrite to make sure the data doesn't cross a page boundary.  Returns 0 or -1 if the stream is
+// full.
+//
+// Response:  0x1 for the start bit, 0x1 for each bulk write command followed by an ACK (0x0) or NACK (0x1) for every
+// byte in it, 0x1 for the stop bit.
+int streampagewrite (struct commandstream *stream, int address, char *data, int length) {
+
+  struct transaction *transaction;
+  char *command, *expect;
+  int i, j, n, words;
+
+  words = stream->profile->words;
+  transaction = streamadd (stream, TRANSPAGEWRITE, PAGEWRITESIZE (length, words), PAGEWRITESIZE (length, words));
+
+  if (transaction == NULL) {
+    return -1;
+  }
+
+  transaction->address = address;
+  transaction->length = length;
+
+  // The first bulk write carries the device write address (the block is in here) and the write address (the high byte
+  // first if there are 2), the data bytes are copied in one piece per bulk write.  i counts address + data bytes.
+  // Expected response:  0x1 for the start bit, the bulk writes and the stop bit, ACK (0x0) for everything else.
+  command = &stream->command[stream->commandlength];
+  expect = &stream->expect[transaction->responsestart];
+  memset (expect, 0, PAGEWRITESIZE (length, words));
+  memset (&stream->mask[transaction->responsestart], 0xFF, PAGEWRITESIZE (length, words));
+  n = 0;
+  expect[n] = 1;
+  command[n++] = CMDSTART;
+
+  for (i = 0; i < length + words + 1; i = i + j) {
+    j = (length + words + 1 - i > BULKWRITEMAX) ? BULKWRITEMAX : length + words + 1 - i;
+    assert (BULKWRITEOK (j));
+    expect[n] = 1;
+    command[n++] = CMDBULKWRITE (j);
+
+    if (i == 0) {
+      command[n++] = deviceaddress (stream->profile, address);
+
+      if (words == 2) {
+        command[n++] = address >> 8;
+      }
+
+      command[n++] = address;
+      memcpy (&command[n], data, j - words - 1);
+    }
+    else {
+      memcpy (&command[n], &data[i - words - 1], j);
+    }
+
+    n = n + ((i == 0) ? j - words - 1 : j);
+  }
+
+  expect[n] = 1;
+  command[n++] = CMDSTOP;
+  command[n] = CMDEND;
+  stream->commandlength = stream->commandlength + n;
+
+  return 0;
+}
+
+// Queue a group of ACK polls for the page write at address:  start bit, 1 byte bulk write with the device write
+// address, stop bit.  While the EEPROM is busy with a write cycle it NACKs its own address.  We can't wait for the
+// answer in the middle of a batch, so queue enough polls to cover the whole write cycle ... the parser is happy as long
+// as one of them got an ACK (and see streamwritecycle if none of them did).  Returns 0 or -1 if the stream is full.
+//
+// Response for every poll:  0x1 (start), 0x1 (bulk write), ACK (0x0) or NACK (0x1), 0x1 (stop)
+int streamackpoll (struct commandstream *stream, int address, int polls) {
+
+  struct transaction *transaction;
+  int i, n;
+
+  transaction = streamadd (stream, TRANSACKPOLL, ACKPOLLSIZE * polls, ACKPOLLSIZE * polls);
+
+  if (transaction == NULL) {
+    return -1;
+  }
+
+  transaction->address = address;
+  transaction->length = polls;
+
+  // Copy the polls from the template ... ACKPOLLCOUNT at a time
+  for (i = 0; i < polls; i = i + ACKPOLLCOUNT) {
+    n = (polls - i > ACKPOLLCOUNT) ? ACKPOLLCOUNT : polls - i;
+    memcpy (&stream->command[stream->commandlength], ackpolls, ACKPOLLSIZE * n);
+    memcpy (&stream->expect[transaction->responsestart + ACKPOLLSIZE * i], ackpollexpect, ACKPOLLSIZE * n);
+    memcpy (&stream->mask[transaction->responsestart + ACKPOLLSIZE * i], ackpollmask, ACKPOLLSIZE * n);
+    stream->commandlength = stream->commandlength + ACKPOLLSIZE * n;
+  }
+
+  stream->command[stream->commandlength] = CMDEND;
+
+  return 0;
+}
+
+// Queue a sequential read of length bytes starting at address into data:  start bit, bulk write (device write address,
+// 1 or 2 read address bytes), start bit, 1 byte bulk write (device read address), read + ACK for every byte but the
+// last, read + NACK for the last byte, stop bit.  Returns 0 or -1 if the stream is full.
+//
+// Response:  0x1, 0x1, ACK for every address byte, 0x1, 0x1, ACK, then the data byte and 0x1 for every byte we read,
+// 0x1 for the stop bit
+int streamread (struct commandstream *stream, int address, char *data, int length) {
+
+  struct transaction *transaction;
+  char *command, *expect, *mask;
+  int i, n, words;
+
+  words = stream->profile->words;
+  transaction = streamadd (stream, TRANSREAD, READSIZE (words, length), READSIZE (words, length));
+
+  if (transaction == NULL) {
+    return -1;
+  }
+
+  transaction->address = address;
+  transaction->length = length;
+  transaction->data = data;
+
+  // The header depends on the number of address bytes, so build it here.  The read + ACK pairs come from the templates
+  // ... NACK the last byte.  Reads longer than READCHUNK (never from streamqueueread) take the read + ACK pairs a chunk
+  // at a time.
+  command = &stream->command[stream->commandlength];
+  expect = &stream->expect[transaction->responsestart];
+  mask = &stream->mask[transaction->responsestart];
+  memset (expect, 0, READHEADERSIZE (words));
+  memset (mask, 0xFF, READHEADERSIZE (words));
+  n = 0;
+  expect[n] = 1;
+  command[n++] = CMDSTART;
+  assert (BULKWRITEOK (words + 1));
+  expect[n] = 1;
+  command[n++] = CMDBULKWRITE (words + 1);
+  command[n++] = deviceaddress (stream->profile, address);	// Device write address
+
+  if (words == 2) {
+    command[n++] = address >> 8;		// Read address
+  }
+
+  command[n++] = address;
+  expect[n] = 1;
+  command[n++] = CMDSTART;
+  expect[n] = 1;
+  command[n++] = CMDBULKWRITE (1);
+  command[n++] = deviceaddress (stream->profile, address) + 1;	// Device read address
+
+  for (i = 0; i < length; i = i + n) {
+    n = (length - i > READCHUNK) ? READCHUNK : length - i;
+    memcpy (&command[READDATA (words, i)], readacks, 2 * n);
+    memcpy (&expect[READDATA (words, i)], readexpect, 2 * n);
+    memcpy (&mask[READDATA (words, i)], readmask, 2 * n);
+  }
+
+  if (length > 0) {
+    command[READDATA (words, length - 1) + 1] = CMDNACK;
+  }
+
+  command[READSTOP (words, length)] = CMDSTOP;
+  expect[READSTOP (words, length)] = 1;
+  mask[READSTOP (words, length)] = 0xFF;
+  command[READSIZE (words, length)] = CMDEND;
+  stream->commandlength = stream->commandlength + READSIZE (words, length);
+
+  return 0;
+}
+
+// Queue sequential reads of up to READCHUNK bytes that never cross a block boundary (READCHUNK divides a 24LC08B
+// block), starting at address, until we run out of data or room in the stream.  Returns the number of bytes queued.
+int streamqueueread (struct commandstream *stream, int address, char *data, int length) {
+
+  int count, done;
+
+  done = 0;
+
+  while (done < length) {
+    count = READCHUNK - ((address + done) % READCHUNK);
+
+    if (count > length - done) {
+      count = length - done;
+    }
+
+    if (streamread (stream, address + done, &data[done], count) == -1) {
+      break;
+    }
+
+    done = done + count;
+  }
+
+  return done;
+}
+
+// Queue planned page writes (each one followed by enough ACK polls for the EEPROM's write cycle, see profilepolls)
+// starting at address ... up to STREAMPAGES of them.  If
+// current isn't NULL it holds what's in the EEPROM right now (indexed by EEPROM address) and pages that already match
+// it are skipped.  pages and skipped (if they aren't NULL) are incremented for every page we planned and every page we
+// skipped.  Returns the number of bytes we got through (written or skipped) or -1 if a page write doesn't fit.
+int streamqueuewrite (struct commandstream *stream, int address, char *data, int length, char *current, int *pages,
+                      int *skipped) {
+
+  int count, done, polls;
+
+  done = 0;
+  polls = profilepolls (stream->profile);
+
+  while ((done < length) && (stream->count < STREAMPAGES * 2)) {
+    count = planwrite (stream->profile, address + done, length - done);
+
+    if (pages != NULL) {
+      (*pages)++;
+    }
+
+    if ((current != NULL) && (memcmp (&current[address + done], &data[done], count) == 0)) {
+      if (skipped != NULL) {
+        (*skipped)++;
+      }
+    }
+    else if ((streampagewrite (stream, address + done, &data[done], count) == -1) ||
+             (streamackpoll (stream, address + done, polls) == -1)) {
+      return -1;
+    }
+
+    done = done + count;
+  }
+
+  return done;
+}
+
+// Compare length response bytes with what we expect ... only the bits that are set in mask count.  Goes through the
+// response 8 bytes at a time and only looks at single bytes to find the one that's wrong.  Returns the offset of the
+// first bad byte or -1 if they're all good.
+int streamvalidate (const char *response, const char *expect, const char *mask, int length) {
+
+  uint64_t r, e, m;
+  int i;
+
+  for (i = 0; i + 8 <= length; i = i + 8) {
+    memcpy (&r, &response[i], 8);
+    memcpy (&e, &expect[i], 8);
+    memcpy (&m, &mask[i], 8);
+
+    if (((r ^ e) & m) != 0) {
+      break;
+    }
+  }
+
+  for (; i < length; i++) {
+    if (((response[i] ^ expect[i]) & mask[i]) != 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// What's wrong with a transaction whose response byte at offset (from the start of the transaction) is bad.  words is
+// the number of word address bytes.
+static const char *responseerror (struct transaction *transaction, int offset, int words) {
+
+  int group;
+
+  if (transaction->type == TRANSACKPOLL) {
+    return "ACK poll error on Bus Pirate";
+  }
+
+  if (transaction->type == TRANSREAD) {
+    if (((offset >= 2) && (offset < words + 3)) || (offset == words + 5)) {
+      return "Device address or read address write error on Bus Pirate - NACK";
+    }
+    if (offset < READHEADERSIZE (words)) {
+      return "Start bit or bulk write error on Bus Pirate";
+    }
+    if (offset == READSTOP (words, transaction->length)) {
+      return "Stop bit error on Bus Pirate";
+    }
+    return "ACK/NACK error on Bus Pirate";
+  }
+
+  // Page write:  start bit, then a bulk write command and up to BULKWRITEMAX bytes for every group, then the stop bit
+  if (offset == 0) {
+    return "Start bit error on Bus Pirate";
+  }
+  if (offset == transaction->responselength - 1) {
+    return "Stop bit error on Bus Pirate";
+  }
+
+  group = (offset - 1) / (BULKWRITEMAX + 1);
+  offset = (offset - 1) % (BULKWRITEMAX + 1);
+
+  if (offset == 0) {
+    return "Bulk write command error on Bus Pirate";
+  }
+  if ((group == 0) && (offset == 1)) {
+    return "Did not receive ACK for write device address from Bus Pirate";
+  }
+  if ((group == 0) && (offset <= words + 1)) {
+    return "Did not receive ACK for write address from Bus Pirate";
+  }
+  return "Did not recieve ACK for data byte from Bus Pirate";
+}
+
+// Check every transaction whose response has completely arrived (the first received bytes in the ring).  All the
+// status bytes of those transactions are checked in one pass (streamvalidate against the expected response the
+// encoders built), right where they are in the ring ... at most two pieces if the response wraps around.  Then the
+// data we read is copied out and the ACK polls are checked for at least one ACK.  Returns 0 if they all look good or
+// -1 if one failed ... failed, failedoffset and error in the stream tell you which one and why.
+int streamcheck (struct commandstream *stream, struct ringbuffer *ring, int received) {
+
+  struct transaction *transaction;
+  int i, last, start, end, offset, index, count, bad, acked;
+
+  for (last = stream->checked; (last < stream->count) &&
+       (stream->transactions[last].responsestart + stream->transactions[last].responselength <= received); last++);
+
+  if (last == stream->checked) {
+    return 0;					// Not all here yet ... check it next time
+  }
+
+  start = stream->transactions[stream->checked].responsestart;
+  end = stream->transactions[last - 1].responsestart + stream->transactions[last - 1].responselength;
+  bad = -1;
+
+  for (offset = start; (bad == -1) && (offset < end); offset = offset + count) {
+    index = (ring->tail + offset) & (RINGSIZE - 1);
+    count = (end - offset < RINGSIZE - index) ? end - offset : RINGSIZE - index;
+    bad = streamvalidate (&ring->data[index], &stream->expect[offset], &stream->mask[offset], count);
+
+    if (bad != -1) {
+      bad = bad + offset;
+    }
+  }
+
+  while (stream->checked < last) {
+    transaction = &stream->transactions[stream->checked];
+    start = transaction->responsestart;
+    stream->failed = stream->checked;
+
+    if ((bad != -1) && (bad < start + transaction->responselength)) {
+      stream->failedoffset = bad;
+      stream->error = responseerror (transaction, bad - start, stream->profile->words);
+      return -1;
+    }
+
+    if (transaction->type == TRANSACKPOLL) {
+      for (i = 0, acked = 0; (i < transaction->length) && (!acked); i++) {
+        acked = (RINGBYTE (ring, start + ACKPOLLSIZE * i + 2) == 0);
+      }
+
+      if (!acked) {
+        stream->failedoffset = start;
+        stream->error = "EEPROM did not finish write cycle";
+        return -1;
+      }
+
+      stream->busy = 0;
+    }
+    else if (transaction->type == TRANSREAD) {
+      for (i = 0; i < transaction->length; i++) {
+        transaction->data[i] = RINGBYTE (ring, start + READDATA (stream->profile->words, i));
+      }
+    }
+
+    stream->failed = -1;
+    stream->checked++;
+  }
+
+  return 0;
+}
+
+// None of the ACK polls after a page write got an ACK (streamcheck failed on a TRANSACKPOLL) ... the write cycle
+// outlasted the polls we queued for it.  A slow part does that, and so does a Bus Pirate (or an emulator with a small
+// -b) that gets through the polls faster than ACKPOLLSPERMS says.  Returns 0 if we should keep waiting:  let the rest
+// of the response go by, send another group of ACK polls for the page (the failed transaction's address) on its own
+// and carry on with the page after it once one of them gets an ACK.  Returns -1 if the stream failed for good.
+//
+// The page writes behind the polls that ran out may have started write cycles of their own by the time the rest of
+// the batch has gone by, so the clock only starts with the first of those extra groups.  It's an error once they have
+// been getting NACKs for WRITECYCLETIMEOUT ms.
+int streamwritecycle (struct commandstream *stream) {
+
+  long long now;
+
+  if ((stream->failed == -1) || (stream->transactions[stream->failed].type != TRANSACKPOLL)) {
+    return -1;
+  }
+
+  if (stream->failed > 0) {		// Polls behind a page write ... the extra groups haven't started yet
+    stream->busy = 0;
+    return 0;
+  }
+
+  now = bpmicros ();
+
+  if (stream->busy == 0) {
+    stream->busy = now;
+  }
+
+  return (now - stream->busy < WRITECYCLETIMEOUT * 1000LL) ? 0 : -1;
+}
+
+// Start writing length bytes of data at address (see struct writerange).  current, pages and skipped go to
+// streamqueuewrite.
+void streamwritestart (struct writerange *range, int address, char *data, int length, char *current, int *pages,
+                       int *skipped) {
+
+  range->address = address;
+  range->data = data;
+  range->length = length;
+  range->current = current;
+  range->pages = pages;
+  range->skipped = skipped;
+  range->done = 0;
+  range->counted = 0;
+  range->wait = -1;
+}
+
+// Start a new batch for the write range.  If a page is still in its write cycle (see streamwritebusy), the batch is
+// another group of ACK polls for that page on its own.  Otherwise it's the next STREAMPAGES planned page writes (the
+// pages after a re-polled page were counted the first time around, so they aren't counted again).  The stream can end
+// up empty if every page in the batch was skipped ... call it again while WRITEPENDING says there's more.  Returns the
+// number of bytes we got through or -1 if a page write doesn't fit (should never happen).
+int streamnextwrite (struct commandstream *stream, struct writerange *range) {
+
+  int count;
+
+  streamreset (stream);
+
+  if (range->wait != -1) {
+    streamackpoll (stream, range->wait, profilepolls (stream->profile));
+    range->wait = -1;
+    return 0;
+  }
+
+  if (range->done < range->counted) {
+    count = streamqueuewrite (stream, range->address + range->done, &range->data[range->done],
+                              range->counted - range->done, range->current, NULL, NULL);
+  }
+  else {
+    count = streamqueuewrite (stream, range->address + range->done, &range->data[range->done],
+                              range->length - range->done, range->current, range->pages, range->skipped);
+  }
+
+  if (count == -1) {
+    return -1;
+  }
+
+  range->done = range->done + count;
+
+  if (range->done > range->counted) {
+    range->counted = range->done;
+  }
+
+  return count;
+}
+
+// streamcheck failed on a batch from streamnextwrite.  If it's a page that outlasted its ACK polls and is still worth
+// waiting for (see streamwritecycle), set the range up so the next batch polls that page again and then carries on
+// with the page after it.  Returns 0 if we're waiting (let the rest of the response go by first) or -1 if the write
+// failed for good.
+int streamwritebusy (struct commandstream *stream, struct writerange *range) {
+
+  int end;
+
+  if (streamwritecycle (stream) == -1) {
+    return -1;
+  }
+
+  end = range->address + range->length;
+  range->wait = stream->transactions[stream->failed].address;
+  range->done = range->wait - range->address + planwrite (stream->profile, range->wait, end - range->wait);
+
+  return 0;
+}
+
+// Send the whole command stream with a single write and parse the response as it comes in.  We stop reading as soon
+// as a transaction fails.  The response is used up when we're done with it (all of it if everything went OK) ... after
+// a failure the rest of it is still on its way, so drain it before sending anything else.  Returns the number of
+// transactions that completed OK (stream->count if they all did) or -1 on an I/O error (errno tells you what ...
+// ETIMEDOUT if the Bus Pirate went quiet for more than timeout milliseconds).
+int streamsend (struct buspirate *bp, struct commandstream *stream, int timeout) {
+
+  long long start;
+  int received, checked, result;
+
+  start = bpmicros ();
+
+  if (bpsend (bp, stream->command, stream->commandlength) == -1) {
+    return -1;
+  }
+
+  received = 0;
+
+  while (received < stream->responselength) {
+    if (bpfill (bp, received + 1, timeout) == -1) {
+      return -1;
+    }
+
+    received = RINGCOUNT (&bp->rx);
+
+    if (received > stream->responselength) {
+      received = stream->responselength;
+    }
+
+    // Charge each transaction that just checked out OK with the time since the one before it finished (or since we
+    // sent the stream) ... that's how long the Bus Pirate spent on it.  Transactions that finish in the same read
+    // get close to 0.
+    checked = stream->checked;
+    result = streamcheck (stream, &bp->rx, received);
+
+    for (; checked < stream->checked; checked++) {
+      bprecord (bp, (stream->transactions[checked].type == TRANSPAGEWRITE) ? STATPAGEWRITE :
+                (stream->transactions[checked].type == TRANSACKPOLL) ? STATACKPOLL : STATREAD, start);
+      start = bpmicros ();
+    }
+
+    if (result == -1) {
+      break;
+    }
+  }
+
+  bp->rx.tail = bp->rx.tail + received;
+
+  return stream->checked;
+}
+
+// The stream failed ... remember what went wrong (and where) in bp and throw away the rest of the response
+static int streamfailed (struct buspirate *bp) {
+
+  bp->error = bp->stream.error;
+  bp->erroraddress = bp->stream.transactions[bp->stream.failed].address;
+  bpdrain (bp, BANNERTIMEOUT);
+
+  return 1;
+}
+
+// Read length bytes starting at address into data with "write then read" (see bpprobebulkread).  Use two requests and
+// send them with a single write:
+//  - The first request writes the device write address and the read address (and reads nothing) ... this sets the
+//    EEPROM's address pointer.  The Bus Pirate answers 0x1.
+//  - The second request writes the device read address and reads length bytes.  The Bus Pirate ACKs every byte but
+//    the last, sends the stop bit and answers 0x1 followed by the data.
+// Total response:  2 + length bytes.  The range can't cross a block boundary (see deviceaddress).  Returns 0, -1 on an
+// I/O error or 1 if the Bus Pirate answered with a NACK.
+int bpbulkread (struct buspirate *bp, int address, char *data, int length) {
+
+  long long start;
+  char command[WRITEREADSIZE (2)];
+  int i, n, words;
+
+  // Each request:  0x8, number of bytes to write (2 bytes), number of bytes to read (2 bytes), the bytes to write
+  words = bp->profile->words;
+  n = 0;
+  command[n++] = CMDWRITEREAD;
+  command[n++] = 0;
+  command[n++] = words + 1;
+  command[n++] = 0;
+  command[n++] = 0;
+  command[n++] = deviceaddress (bp->profile, address);
+
+  if (words == 2) {
+    command[n++] = address >> 8;
+  }
+
+  command[n++] = address;
+  command[n++] = CMDWRITEREAD;
+  command[n++] = 0;
+  command[n++] = 1;
+  command[n++] = length >> 8;
+  command[n++] = length & 0xFF;
+  command[n++] = deviceaddress (bp->profile, address) + 1;
+  start = bpmicros ();
+
+  if (bpsend (bp, command, n) == -1) {
+    return -1;
+  }
+
+  // A status byte for each request first.  The data only comes after an ACKed read request ... on a NACK there's
+  // nothing else to wait for.
+  if (bpfill (bp, 2, RESPONSETIMEOUT) == -1) {
+    return -1;
+  }
+
+  // The block takes a while to come across the serial line ... bpfill keeps reading until all of it has arrived
+  if ((RINGBYTE (&bp->rx, 1) == 1) && (bpfill (bp, length + 2, RESPONSETIMEOUT) == -1)) {
+    return -1;
+  }
+
+  bprecord (bp, STATBULKREAD, start);
+
+  if ((RINGBYTE (&bp->rx, 0) != 1) || (RINGBYTE (&bp->rx, 1) != 1)) {
+    bp->rx.tail = bp->rx.tail + ((RINGBYTE (&bp->rx, 1) == 1) ? length + 2 : 2);
+    bp->error = "Write then read error on Bus Pirate - NACK";
+    bp->erroraddress = address;
+    return 1;
+  }
+
+  for (i = 0; i < length; i++) {
+    data[i] = RINGBYTE (&bp->rx, 2 + i);
+  }
+
+  bp->rx.tail = bp->rx.tail + length + 2;
+
+  return 0;
+}
+
+// Put length bytes of data (just read from or written to address) in the shadow copy.  A page gets a new generation
+// stamp if we now know all of it ... it was covered completely or we already knew the rest.
+static void shadowstore (struct buspirate *bp, int address, char *data, int length) {
+
+  struct shadow *shadow;
+  int page, start, end, pagesize;
+
+  shadow = &bp->shadow;
+  pagesize = bp->profile->pagesize;
+
+  if (length <= 0) {
+    return;
+  }
+
+  memmove (&shadow->data[address], data, length);
+  shadow->generation++;
+
+  for (page = address / pagesize; page <= (address + length - 1) / pagesize; page++) {
+    start = page * pagesize;
+    end = start + pagesize;
+
+    if (((start >= address) && (end <= address + length)) || (shadow->stamps[page] != 0)) {
+      shadow->stamps[page] = shadow->generation;
+    }
+  }
+}
+
+// Read length bytes starting at address into data.  If the firmware supports "write then read" the range is read in
+// bursts of the profile's burst size (a whole block on the 24LC08B), one bulk read each.  Otherwise the range is split
+// into sequential reads of up to READCHUNK bytes that never cross a block boundary, and as many of them as fit go into
+// each command stream.  Returns 0, -1 on an I/O error (errno tells you what) or 1 if a transaction failed (error and
+// erroraddress in bp tell you why and where).
+int bpreadrange (struct buspirate *bp, int address, char *data, int length) {
+
+  struct commandstream *stream;
+  int result, count, done;
+
+  stream = &bp->stream;
+  done = 0;
+
+  while ((bp->bulkread) && (done < length)) {
+    count = bp->profile->burst - ((address + done) % bp->profile->burst);
+
+    if (count > length - done) {
+      count = length - done;
+    }
+
+    result = bpbulkread (bp, address + done, &data[done], count);
+
+    if (result != 0) {
+      return result;
+    }
+
+    done = done + count;
+  }
+
+  while (done < length) {
+    streamreset (stream);
+    count = streamqueueread (stream, address + done, &data[done], length - done);
+
+    if (count == 0) {			// A single read doesn't fit in the stream ... should never happen
+      errno = ENOBUFS;
+      return -1;
+    }
+
+    done = done + count;
+
+    result = streamsend (bp, stream, RESPONSETIMEOUT);
+
+    if (result == -1) {
+      return -1;
+    }
+    if (result < stream->count) {
+      return streamfailed (bp);
+    }
+  }
+
+  streamreset (stream);
+  shadowstore (bp, address, data, length);
+
+  return 0;
+}
+
+// Write length bytes from data to the EEPROM starting at address.  Each write is planned with planwrite, followed by
+// its ACK polls and queued in the command stream ... up to STREAMPAGES page writes go out with each write.  If
+// current isn't NULL it holds what's in the EEPROM right now (indexed by EEPROM address) and pages that already match
+// it are skipped.  pages and skipped (if they aren't NULL) are incremented for every page we planned and every page we
+// skipped.  Returns 0, -1 on an I/O error (errno tells you what) or 1 if a transaction failed (error and erroraddress
+// in bp tell you why and where).
+int bpwriterange (struct buspirate *bp, int address, char *data, int length, char *current, int *pages, int *skipped) {
+
+  struct commandstream *stream;
+  struct writerange range;
+  unsigned int tail;
+  int result, count;
+
+  stream = &bp->stream;
+  streamwritestart (&range, address, data, length, current, pages, skipped);
+
+  while (WRITEPENDING (&range)) {
+    if (streamnextwrite (stream, &range) == -1) {
+      errno = ENOBUFS;			// Page write doesn't fit in the stream ... should never happen
+      return -1;
+    }
+
+    if (stream->count == 0) {		// Every page in this batch was skipped
+      continue;
+    }
+
+    tail = bp->rx.tail;
+    result = streamsend (bp, stream, RESPONSETIMEOUT);
+
+    if (result == -1) {
+      bpshadowinvalidate (bp, address, length);	// No idea what made it
+      return -1;
+    }
+
+    // A page that's still busy ... let the rest of the batch's response go by (we know exactly how much is left) and
+    // poll it again in the next batch
+    if ((result < stream->count) && (streamwritebusy (stream, &range) == 0)) {
+      count = stream->responselength - (bp->rx.tail - tail);
+
+      if (bpfill (bp, count, RESPONSETIMEOUT) == -1) {
+        bpshadowinvalidate (bp, address, length);
+        return -1;
+      }
+
+      bp->rx.tail = bp->rx.tail + count;
+      continue;
+    }
+    if (result < stream->count) {
+      bpshadowinvalidate (bp, address, length);
+      return streamfailed (bp);
+    }
+  }
+
+  streamreset (stream);
+  shadowstore (bp, address, data, length);	// Write-through
+
+  return 0;
+}
+
+// Forget what's in the pages between address and address + length - 1.  The next bpshadowread reads them again.
+void bpshadowinvalidate (struct buspirate *bp, int address, int length) {
+
+  int page, pagesize;
+
+  pagesize = bp->profile->pagesize;
+
+  for (page = address / pagesize; (length > 0) && (page <= (address + length - 1) / pagesize); page++) {
+    bp->shadow.stamps[page] = 0;
+  }
+}
+
+// Read length bytes starting at address into data ... from the shadow copy if we already know what's in those pages,
+// from the EEPROM if we don't.  Pages we don't know yet are read a run of whole pages at a time.  Returns 0, -1 on an
+// I/O error or 1 if a transaction failed (like bpreadrange).
+int bpshadowread (struct buspirate *bp, int address, char *data, int length) {
+
+  struct shadow *shadow;
+  int result, first, last, page, pagesize;
+
+  shadow = &bp->shadow;
+  pagesize = bp->profile->pagesize;
+  first = address / pagesize;
+  last = (address + length - 1) / pagesize;
+
+  for (page = first; (length > 0) && (page <= last); page++) {
+    if (shadow->stamps[page] != 0) {
+      bp->stats.shadowhits++;
+      continue;
+    }
+
+    for (first = page; (page < last) && (shadow->stamps[page + 1] == 0); page++);
+
+    // bpreadrange puts what it read in the shadow copy
+    result = bpreadrange (bp, first * pagesize, &shadow->data[first * pagesize], (page - first + 1) * pagesize);
+
+    if (result != 0) {
+      return result;
+    }
+
+    bp->stats.shadowmisses = bp->stats.shadowmisses + page - first + 1;
+  }
+
+  if (length > 0) {
+    memcpy (data, &shadow->data[address], length);
+  }
+
+  return 0;
+}
+
+// Read length bytes starting at address from the EEPROM no matter what the shadow copy says (like after somebody else
+// wrote the EEPROM, or to verify a write ... write-through only tells us what we sent, not what landed).  The shadow
+// copy gets the fresh data.  Returns 0, -1 on an I/O error or 1 if a transaction failed (like bpreadrange).
+int bprevalidate (struct buspirate *bp, int address, char *data, int length) {
+
+  bpshadowinvalidate (bp, address, length);
+
+  return bpshadowread (bp, address, data, length);
+}
@@ -0,0 +1,311 @@
+/*
+Bus Pirate binary I2C mode library for the 24xx serial EEPROM programs (24LC08B, 24LC256 and 24LC512 ... see
+struct eepromprofile).
+
+Everything the three programs used to do inline in main lives here:  opening and setting up the serial
+port, entering and leaving binary I2C mode, waiting for responses, setting the I2C speed and the I2C
+transactions themselves (page writes, ACK polls, sequential reads and "write then read" bulk reads).
+bus_pirate_read.c, bus_pirate_write.c and bus_pirate_write_all.c are just front-ends on top of it.
+
+Responses from the Bus Pirate land in a ring buffer (see struct ringbuffer).  The command stream parser
+checks responses right where they are in the ring, so a big batch of transactions never gets copied
+around.  The encoders also build the response we expect (and a mask for the bytes that can be anything),
+so every status byte of a batch is checked in one pass (streamvalidate).
+
+Most functions return 0 when everything worked, -1 on an I/O error (errno tells you what ... ETIMEDOUT
+if the Bus Pirate didn't answer in time) or 1 if the Bus Pirate or the EEPROM didn't like something (the
+error in struct buspirate tells you what).
+*/
+
+#ifndef BUS_PIRATE_H
+#define BUS_PIRATE_H
+
+#include <stdio.h>
+
+#define EEPROMMAX 65536					 // Biggest EEPROM in the profile table (24LC512) ... for buffers
+#define PAGEMAX 128					 // Biggest page in the profile table
+#define PAGEMIN 16					 // Smallest page in the profile table
+#define BURSTMAX 1024					 // Biggest "write then read" burst in the profile table
+#define READCHUNK 128					 // Bytes per sequential read in a command stream ... divides a block
+#define BULKWRITEMAX 16					 // Maximum number of bytes in a single bulk write command
+#define STREAMPAGES 8					 // Number of page writes to queue in a single command stream
+#define ACKPOLLCOUNT 20					 // ACK polls in the template (more than a 5 ms write cycle needs)
+#define ACKPOLLSPERMS 3					 // ACK polls per ms of write cycle (a poll takes ~350 usec at 115200 baud)
+#define WRITECYCLETIMEOUT 50				 // Milliseconds of ACK polls without an ACK before we give up on a page
+#define MAXTRANSACTIONS (STREAMPAGES * 2 + 2)		 // Page write + ACK polls for each page (and a little room for reads)
+#define STREAMSIZE 4096					 // Room for the commands (or the responses) of a whole command stream
+#define RINGSIZE 8192					 // Receive ring buffer ... has to be a power of 2 and bigger than STREAMSIZE
+#define RESPONSETIMEOUT 1000				 // Milliseconds to wait for a Bus Pirate response before giving up
+#define BANNERTIMEOUT 100				 // Milliseconds of silence that mark the end of the version banner
+#define PROBETIMEOUT 50					 // Milliseconds to wait for an answer to MODEPROBE (none in user mode)
+#define DRAINTIMEOUT 10					 // Milliseconds of silence that end leftovers we don't recognise
+#define NULLCOUNT 25					 // Most nulls we send to get "BBIO1" (user mode takes 20)
+#define PROBESIZE 16					 // Number of bytes to read back when we check a speed
+#define SPEEDCMD 0x60					 // Set I2C speed ... OR in 0 - 3 for 5, 50, 100 or 400 kHz
+#define SPEEDDEFAULT -1					 // Don't send a speed command ... use the firmware default
+#define SPEEDAUTO 4					 // Find the fastest speed that works
+#define TRANSPAGEWRITE 1				 // Command stream transaction types
+#define TRANSACKPOLL 2
+#define TRANSREAD 3
+#define STATBUCKETS 25					 // Latency histogram buckets ... powers of 2 from 1 usec to ~16 s
+#define STATMODE 0					 // Command types for the latency histograms
+#define STATRESET 1
+#define STATSPEED 2
+#define STATPROBE 3
+#define STATPAGEWRITE 4
+#define STATACKPOLL 5
+#define STATREAD 6
+#define STATBULKREAD 7
+#define STATTYPES 8
+#define IMAGERAW 0					 // Image file formats
+#define IMAGEHEX 1					 // Intel HEX
+#define HEXRECORD 16					 // Data bytes per Intel HEX record we write
+#define FRAMEMAGIC "BP"					 // First 2 bytes of a framed image
+#define FRAMEHEADERSIZE 6				 // Framed image header:  magic, length (2 bytes), CRC (2 bytes)
+#define SHADOWPAGES (EEPROMMAX / PAGEMIN)		 // Most pages in the shadow copy of the EEPROM
+#define PROFILES 3					 // EEPROMs in the profile table
+
+#define BBEN "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"  // Send 20 null chars (\0) to ENABLE bitbang or binary mode
+#define I2CEN "\x2"			      	         // Send a STX char (\x2) to ENABLE I2C mode
+#define PPEN "\x4C"				         // Send a L char (\x4C) to enable power and pullup resistors
+#define STOPWRITE "\x3"					 // Send a stop bit
+#define I2CDIS "\0"					 // Send a null char (\0) to DISABLE I2C mode
+#define BBDIS "\xF"					 // Send a SI char (\xF) to DISABLE bitbang or binary mode
+#define MODEEXIT "\0\xF"				 // Disable I2C mode and bitbang mode
+#define MODEPROBE "\x1\x4C"				 // I2C mode version + power and pullups ... see bpentermode
+#define I2CRESUME "\x2\x4C"				 // I2C mode, power and pullups (after "BBIO1")
+#define ACKPOLL "\x2\x10\xA0\x3"			 // ACK poll:  start, 1 byte bulk write, device write address, stop
+#define BULKREADPROBE "\x8\0\0\0\0"			 // Send an empty write then read command (write 0 bytes, read 0 bytes)
+
+// Binary I2C mode commands for the command stream encoders
+#define CMDSTART '\x2'					 // Start bit
+#define CMDSTOP '\x3'					 // Stop bit
+#define CMDREAD '\x4'					 // Read a byte
+#define CMDACK '\x6'					 // ACK the byte we just read
+#define CMDNACK '\x7'					 // NACK the byte we just read (the last one)
+#define CMDWRITEREAD '\x8'				 // Write then read (see bpbulkread)
+#define CMDBULKWRITE(count) (0x10 | ((count) - 1))	 // Bulk write 1 - 16 bytes ... 0x10 is 1 byte
+#define BULKWRITEOK(count) (((count) >= 1) && ((count) <= BULKWRITEMAX))  // Anything else is a different command
+#define CMDEND '\xEE'					 // Our special EOB for debugging ... look for it in gdb
+
+// Frame layouts (words is the number of word address bytes ... see struct eepromprofile).  Every command byte in a
+// stream frame gets exactly one response byte back (the reads answer with the data byte instead of 0x1), so the
+// command and response sizes are the same and the response offsets below are also the command offsets.
+#define PAGEWRITEBULKS(length, words) (((length) + (words) + 1 + BULKWRITEMAX - 1) / BULKWRITEMAX)  // Addresses + data
+#define PAGEWRITESIZE(length, words) (PAGEWRITEBULKS (length, words) + (length) + (words) + 3)  // Start, bulks, stop
+#define ACKPOLLSIZE 4					 // Start, 1 byte bulk write, device address, stop
+#define READHEADERSIZE(words) ((words) + 6)		 // Start, bulk write (addresses), start, 1 byte bulk write
+#define READSIZE(words, length) (READHEADERSIZE (words) + 2 * (length) + 1)  // Header, read + ACK/NACK per byte, stop
+#define READDATA(words, i) (READHEADERSIZE (words) + 2 * (i))	 // Response offset of data byte i
+#define READSTOP(words, length) (READHEADERSIZE (words) + 2 * (length))  // Response offset of the stop bit
+#define WRITEREADSIZE(words) ((words) + 12)		 // Both write then read commands (see bpbulkread)
+
+// What we need to know about an EEPROM.  All of them are Microchip 24xx parts at device address 0xA0.
+struct eepromprofile {
+  const char *name;
+  int size;			// Bytes
+  int pagesize;			// A page write can't cross a page boundary
+  int words;			// Word address bytes:  1 (the block goes in the device address) or 2
+  int blockbits;		// Block select bits in the device address (1 word address byte only)
+  int writecycle;		// Longest write cycle (usec)
+  int burst;			// Bytes per "write then read" ... a read can't cross a block boundary with blocks
+};
+
+// Receive ring buffer.  head and tail only ever count up ... RINGBYTE wraps them into the buffer.  The bytes between
+// tail and head are the ones we've received but nobody has used yet.
+struct ringbuffer {
+  char data[RINGSIZE];
+  unsigned int head;		// Where the next byte from the Bus Pirate goes
+  unsigned int tail;		// The oldest byte we haven't used yet
+};
+
+#define RINGCOUNT(ring) ((int) ((ring)->head - (ring)->tail))
+#define RINGBYTE(ring, offset) ((ring)->data[((ring)->tail + (offset)) & (RINGSIZE - 1)])
+
+// A command stream holds a whole batch of I2C transactions (page writes, ACK polls, reads) so that we can send all of
+// them with a single write.  For every transaction we remember where its response starts in the reply and how long
+// it is.  The parser uses this to check each transaction as soon as its bytes have arrived.
+struct transaction {
+  int type;			// TRANSPAGEWRITE, TRANSACKPOLL or TRANSREAD
+  int address;			// EEPROM address (page writes, reads and the page an ACK poll group waits for)
+  int length;			// Number of data bytes (page writes and reads) or number of polls (ACK polls)
+  char *data;			// Where to put the data we read (reads only)
+  int responsestart;		// Offset of the first response byte for this transaction
+  int responselength;		// Number of response bytes for this transaction
+};
+
+struct commandstream {
+  char command[STREAMSIZE];	// All the Bus Pirate commands for the batch
+  int commandlength;
+  struct transaction transactions[MAXTRANSACTIONS];
+  int count;			// Number of queued transactions
+  int checked;			// Number of transactions the parser has already checked
+  int responselength;		// Total number of response bytes we expect for the batch
+  char expect[STREAMSIZE];	// What the response should look like ...
+  char mask[STREAMSIZE];	// ... where mask is set (0 for data bytes and ACK poll answers)
+  int failed;			// Index of the transaction that failed or -1
+  int failedoffset;		// Offset of the bad response byte
+  const char *error;		// What went wrong
+  long long busy;		// When the first extra ACK poll group for a busy page got all NACKs (usec) or 0
+  const struct eepromprofile *profile;	// The EEPROM the commands are for
+};
+
+// Where a write of any length is (bpwriterange and bus_pirate_station.c).  streamnextwrite queues the next batch of
+// page writes and streamwritebusy decides what happens when a page outlasts its ACK polls ... both writers go through
+// them, so they re-poll a busy page the same way.
+struct writerange {
+  int address;			// EEPROM address of data[0]
+  char *data;
+  int length;
+  char *current;		// What's in the EEPROM (indexed by EEPROM address) ... pages that match are skipped ... or NULL
+  int *pages;			// Pages planned and skipped (for streamqueuewrite) or NULL
+  int *skipped;
+  int done;			// Bytes queued (written or skipped) so far
+  int counted;			// Bytes whose pages have been counted ... they don't count again after a re-poll
+  int wait;			// Page that outlasted its ACK polls (see streamwritecycle) or -1
+};
+
+#define WRITEPENDING(range) (((range)->done < (range)->length) || ((range)->wait != -1))
+
+// Round trip latency for one command type.  Bucket i counts the round trips that took 2^i to 2^(i+1) - 1 usec
+// (bucket 0 gets everything under 2 usec, the last bucket everything that's too big for the others).
+struct latency {
+  long count;
+  long long total;		// usec
+  long long max;		// usec
+  long buckets[STATBUCKETS];
+};
+
+// Where the time went.  bpwritestats writes all of it as JSON.
+struct bpstats {
+  long long started;		// usec (CLOCK_MONOTONIC) when we opened the port
+  long reads;			// read() calls
+  long writes;			// write() calls
+  long polls;			// poll() calls
+  long long bytesread;
+  long long byteswritten;
+  long timeouts;		// Responses that didn't arrive in time
+  long shadowhits;		// Pages bpshadowread got from the shadow copy
+  long shadowmisses;		// Pages bpshadowread had to read from the EEPROM
+  struct latency commands[STATTYPES];
+};
+
+// Shadow copy of the EEPROM for the whole session.  Every page has a generation stamp:  0 means we don't know what's
+// in the page, anything else is the generation it was last read or written in.  Reads and writes keep it up to date
+// (write-through), so bpshadowread only has to go to the EEPROM for pages nobody has touched yet.
+struct shadow {
+  char data[EEPROMMAX];
+  unsigned int generation;	// Bumped every time pages are read or written
+  unsigned int stamps[SHADOWPAGES];
+};
+
+// Everything we know about one Bus Pirate
+struct buspirate {
+  int fd;
+  char device[64];		// Serial port the Bus Pirate is attached to
+  struct ringbuffer rx;		// Responses we've received but haven't used yet
+  struct commandstream stream;	// Command stream for page writes and reads
+  int bulkread;			// 1 if the firmware supports "write then read"
+  int speed;			// I2C speed (0 - 3) or SPEEDDEFAULT if we never set it
+  const char *error;		// What went wrong (when a function returns 1)
+  int erroraddress;		// EEPROM address we were working on when it went wrong or -1
+  long roundtrips;		// Number of times we sent commands to the Bus Pirate (bus_pirate_bench.c reports it)
+  int probe;			// 1 if it's probably still in binary I2C mode (-k) ... bpentermode asks first
+  const struct eepromprofile *profile;	// The EEPROM on the bus (24LC08B unless bpsetprofile says otherwise)
+  struct shadow shadow;		// What we know is in the EEPROM
+  struct bpstats stats;
+};
+
+// I2C speeds in kHz ... the index is the value that goes in the speed command
+extern const int speeds[4];
+
+// Names of the command types in the JSON summary
+extern const char *statnames[STATTYPES];
+
+// EEPROMs we know about ... the first one is the default
+extern const struct eepromprofile profiles[PROFILES];
+
+// Serial port and receive path
+int setupport (int fd, char *device);
+int bpopen (struct buspirate *bp, char *device);
+void bpclose (struct buspirate *bp);
+int bpsend (struct buspirate *bp, char *command, int length);
+int bpfill (struct buspirate *bp, int count, int timeout);
+int bpreceive (struct buspirate *bp, char *buffer, int count, int timeout);
+int bpreadavailable (struct buspirate *bp);
+void bpdrain (struct buspirate *bp, int timeout);
+
+// Modes and bus setup
+int ringfind (struct ringbuffer *ring, const char *pattern, int length);
+int bpsendnulls (struct buspirate *bp);
+int bpentermode (struct buspirate *bp);
+int bpexitmode (struct buspirate *bp);
+void bpabort (struct buspirate *bp);
+void bpreport (struct buspirate *bp, int result, char *what);
+void bpquit (struct buspirate *bp, int code, char *statsfile);
+void bpfail (struct buspirate *bp, int result, char *what, char *statsfile);
+int bpsetspeed (struct buspirate *bp, int speed);
+int bpprobespeed (struct buspirate *bp);
+int bpautospeed (struct buspirate *bp);
+int parsespeed (char *option);
+int bpprobebulkread (struct buspirate *bp);
+int bpstart (struct buspirate *bp, char *port, const struct eepromprofile *profile, int speed, int probe,
+             char **what);
+
+// EEPROM profiles
+const struct eepromprofile *findprofile (char *name);
+const struct eepromprofile *parseprofile (char *name);
+void bpsetprofile (struct buspirate *bp, const struct eepromprofile *profile);
+int profilepolls (const struct eepromprofile *profile);
+
+// Instrumentation
+long long bpmicros (void);
+void bprecord (struct buspirate *bp, int type, long long start);
+int bpwritestats (struct buspirate *bp, char *name);
+
+// Image files (raw binary or Intel HEX)
+int imageformat (char *name);
+int imageload (char *name, char *data, int size, int *first, int *length, const char **error);
+FILE *imagecreate (char *name);
+int imagewrite (FILE *out, int format, int address, char *data, int length);
+int imageclose (FILE *out, int format);
+
+// Framed images (length + CRC header)
+int framebuild (char *buffer, int length, int size);
+int frameparse (char *header, int *length, int *crc);
+int imageinput (char *imagefile, char *buffer, int size, int framed);
+
+// Addresses, planning and CRCs
+int deviceaddress (const struct eepromprofile *profile, int address);
+int planwrite (const struct eepromprofile *profile, int address, int count);
+int crc16 (char *data, int length);
+
+// Command stream
+void streamreset (struct commandstream *stream);
+struct transaction *streamadd (struct commandstream *stream, int type, int commandlength, int responselength);
+int streampagewrite (struct commandstream *stream, int address, char *data, int length);
+int streamackpoll (struct commandstream *stream, int address, int polls);
+int streamread (struct commandstream *stream, int address, char *data, int length);
+int streamqueueread (struct commandstream *stream, int address, char *data, int length);
+int streamqueuewrite (struct commandstream *stream, int address, char *data, int length, char *current, int *pages,
+                      int *skipped);
+int streamvalidate (const char *response, const char *expect, const char *mask, int length);
+int streamcheck (struct commandstream *stream, struct ringbuffer *ring, int received);
+int streamwritecycle (struct commandstream *stream);
+void streamwritestart (struct writerange *range, int address, char *data, int length, char *current, int *pages,
+                       int *skipped);
+int streamnextwrite (struct commandstream *stream, struct writerange *range);
+int streamwritebusy (struct commandstream *stream, struct writerange *range);
+int streamsend (struct buspirate *bp, struct commandstream *stream, int timeout);
+
+// Reads and writes of any length
+int bpbulkread (struct buspirate *bp, int address, char *data, int length);
+int bpreadrange (struct buspirate *bp, int address, char *data, int length);
+int bpwriterange (struct buspirate *bp, int address, char *data, int length, char *current, int *pages, int *skipped);
+
+// Shadow copy
+void bpshadowinvalidate (struct buspirate *bp, int address, int length);
+int bpshadowread (struct buspirate *bp, int address, char *data, int length);
+int bprevalidate (struct buspirate *bp, int address, char *data, int length);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+Throughput benchmark for the Bus Pirate library.  Runs the same paths the three programs use and reports bytes per
+second and round trips per byte for each one:
+
+ - read:  bpreadrange over the whole EEPROM ("write then read" if the firmware has it, sequential reads if not)
+ - write:  one byte at a time, like bus_pirate_write.c
+ - write_all:  page writes in command streams, like bus_pirate_write_all.c
+
+Every write is read back and checked, so a benchmark run is also a quick regression test.  Run it against
+bus_pirate_emulator (no hardware needed) to catch performance regressions:
+
+    ./bus_pirate_emulator -l /tmp/ttyBP &
+    ./bus_pirate_bench -p /tmp/ttyBP
+
+WARNING:  this overwrites the EEPROM.  Don't point it at a real Bus Pirate with an EEPROM you care about.
+
+Usage:  bus_pirate_bench [-p port] [-n bytes] [-s 5|50|100|400|auto] [-r repeats] [-m min bytes/s] [-j stats.json]
+                        [-e 24LC08B|24LC256|24LC512]
+*/
+
+#include <stdio.h>
+#include <errno.h>		// Error number definitions
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "bus_pirate.h"
+
+#define BENCHREAD 0					 // Benchmarks
+#define BENCHWRITE 1
+#define BENCHWRITEALL 2
+
+char *benchnames[3] = {"read", "write", "write_all"};
+
+char *statsfile = NULL;				// -j:  where to write the JSON summary
+
+// Seconds since some point in the past
+double seconds (void) {
+
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run one benchmark over length bytes.  Returns the number of seconds it took ... the round trips are in bp.
+double bench (struct buspirate *bp, int benchmark, char *data, int length) {
+
+  char readback[EEPROMMAX];
+  double start;
+  int result, i;
+
+  result = 0;
+  start = seconds ();
+
+  if (benchmark == BENCHREAD) {
+    result = bpreadrange (bp, 0, readback, length);
+  }
+  else if (benchmark == BENCHWRITE) {
+    for (i = 0; (i < length) && (result == 0); i++) {
+      result = bpwriterange (bp, i, &data[i], 1, NULL, NULL, NULL);
+    }
+  }
+  else {
+    result = bpwriterange (bp, 0, data, length, NULL, NULL, NULL);
+  }
+
+  start = seconds () - start;
+
+  if (result != 0) {
+    bpfail (bp, result, "Benchmark failed", statsfile);
+  }
+
+  // Check that the data landed (outside of the timing)
+  if (benchmark != BENCHREAD) {
+    result = bpreadrange (bp, 0, readback, length);
+
+    if (result != 0) {
+      bpfail (bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
+    }
+
+    if (memcmp (readback, data, length) != 0) {
+      printf ("%s:  readback doesn't match what we wrote\n", benchnames[benchmark]);
+      bpquit (bp, 5, statsfile);
+    }
+  }
+
+  return start;
+}
+
+int main (int argc, char *argv[]) {
+
+  // Define variables
+  int result, i, j, k, length, option, speed, repeats, slow;
+  long roundtrips;
+  double elapsed, best, rate, minrate;
+  struct buspirate bp;
+  char *port, *what;
+  const struct eepromprofile *profile;
+  char data[EEPROMMAX];
+
+  port = "/dev/ttyUSB0";
+  profile = &profiles[0];
+  length = -1;
+  speed = SPEEDDEFAULT;
+  repeats = 1;
+  minrate = 0;
+  slow = 0;
+
+  // Check the command line options
+  //  -p:  serial port the Bus Pirate is attached to (like the pty from bus_pirate_emulator)
+  //  -j:  write round trip latencies and syscall counters to this file as JSON when we're done (- is stdout)
+  //  -n:  number of bytes to read and write (the whole EEPROM by default)
+  //  -s:  I2C speed ... 5, 50, 100, 400 (kHz) or auto (find the fastest speed that works)
+  //  -r:  run every benchmark this many times and report the best one
+  //  -m:  exit with 6 if the read or write_all benchmark is slower than this many bytes/s
+  //  -e:  EEPROM on the bus ... 24LC08B (the default), 24LC256 or 24LC512
+  while ((option = getopt (argc, argv, "p:n:s:r:m:j:e:")) != -1) {
+    switch (option) {
+      case 'e':
+        profile = parseprofile (optarg);
+        break;
+      case 'p':
+        port = optarg;
+        break;
+      case 'j':
+        statsfile = optarg;
+        break;
+      case 'n':
+        length = atoi (optarg);
+        break;
+      case 's':
+        speed = parsespeed (optarg);
+
+        if (speed == -1) {
+          fprintf (stderr, "Unknown I2C speed:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'r':
+        repeats = atoi (optarg);
+        break;
+      case 'm':
+        minrate = atof (optarg);
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-p port] [-n bytes] [-s 5|50|100|400|auto] [-r repeats] [-m min bytes/s]\n"
+                 "       [-j stats.json] [-e 24LC08B|24LC256|24LC512]\n", argv[0]);
+        exit (1);
+    }
+  }
+
+  if (repeats < 1) {
+    fprintf (stderr, "Number of repeats has to be at least 1\n");
+    exit (1);
+  }
+
+  if (length == -1) {
+    length = profile->size;
+  }
+
+  if ((length < 1) || (length > profile->size)) {
+    fprintf (stderr, "Number of bytes has to be 1 - %d\n", profile->size);
+    exit (1);
+  }
+
+  result = bpstart (&bp, port, profile, speed, 0, &what);
+
+  if (result != 0) {
+    bpfail (&bp, result, what, statsfile);
+  }
+
+  printf ("%s:  %d bytes, %s reads, ", port, length, (bp.bulkread) ? "write then read" : "sequential");
+
+  if (bp.speed == SPEEDDEFAULT) {
+    printf ("default I2C speed\n");
+  }
+  else {
+    printf ("I2C speed %d kHz\n", speeds[bp.speed]);
+  }
+
+  // Run each benchmark.  Use a different pattern for every run so a write can never pass because the data was already
+  // there.
+  for (i = BENCHREAD; i <= BENCHWRITEALL; i++) {
+    best = 0;
+    roundtrips = 0;
+
+    for (j = 0; j < repeats; j++) {
+      for (k = 0; k < length; k++) {
+        data[k] = (k * 7 + i * 31 + j * 13) & 0xFF;
+      }
+
+      bp.roundtrips = 0;
+      elapsed = bench (&bp, i, data, length);
+
+      if ((j == 0) || (elapsed < best)) {
+        best = elapsed;
+        roundtrips = bp.roundtrips;
+      }
+    }
+
+    rate = length / best;
+    printf ("%-10s %8.0f bytes/s  %8.3f s  %6.3f round trips/byte\n", benchnames[i], rate, best,
+            (double) roundtrips / length);
+
+    if ((i != BENCHWRITE) && (rate < minrate)) {
+      slow = 1;
+    }
+  }
+
+  result = bpexitmode (&bp);
+
+  if (result != 0) {
+    bpfail (&bp, result, "Could not reset Bus Pirate to user mode", statsfile);
+  }
+
+  bpclose (&bp);
+
+  if ((statsfile != NULL) && (bpwritestats (&bp, statsfile) == -1)) {
+    fprintf (stderr, "Could not write %s - %s\n", statsfile, strerror (errno));
+  }
+
+  if (slow) {
+    printf ("Slower than %.0f bytes/s\n", minrate);
+    exit (6);
+  }
+}
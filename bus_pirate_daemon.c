@@ -0,0 +1,771 @@
+/*
+Bus Pirate daemon:  open the Bus Pirate once, put it in binary I2C mode with power and pullups on and keep it there.
+Programs talk to the daemon over a Unix socket instead of opening the serial port themselves, so they don't pay for
+the 20 null handshake, mode entry, speed setup, mode exit and the version banner every time ... just for the I2C work.
+
+Any number of local clients can connect.  Requests are served one at a time (the Bus Pirate can only do one thing at
+a time), round robin between the clients that have something queued, so one client sending a pile of requests can't
+starve the others.  Answers never block the daemon:  whatever doesn't fit in a client's socket waits in its output
+buffer until epoll says there's room, and a client doesn't get its next request served until it has read the last
+answer.
+
+The daemon owns the EEPROM, so the library's shadow copy (see bpshadowread) is always right:  repeat reads come from
+memory, writes only touch the pages that changed, and verify always goes to the EEPROM (bprevalidate).
+
+Protocol:  every request is a line "<op> <address> <length>" followed by length data bytes for write and verify.
+  read        Send back the data (from the shadow copy if we have it)
+  revalidate  Same, but read it from the EEPROM no matter what
+  write       Write the data (pages that already match are skipped)
+  verify      Read the range from the EEPROM and compare it with the data
+Every answer starts with a line:  "OK <length> <crc16>" followed by length data bytes (read and revalidate),
+"OK <pages> <skipped>" (write), "OK <crc16>" (verify) or "ERR <what went wrong>".  The CRC is CRC-16/CCITT (see
+crc16).
+
+The same program is also the client:
+
+    ./bus_pirate_daemon -p /dev/ttyUSB0 &
+    ./bus_pirate_daemon -c read -o backup.hex
+    ./bus_pirate_daemon -c write -v -f backup.hex
+
+Raw binary images go at -a (0 by default).  Intel HEX images go where their records say ... -a doesn't work with
+them.  -c read -a 512 -n 64 -o seg.hex and then -c write -f seg.hex puts those 64 bytes right back at 512.
+
+Usage:  bus_pirate_daemon [-p port] [-s 5|50|100|400|auto] [-j stats.json] [-k] [-S socket] [-e eeprom]
+        bus_pirate_daemon -c read|revalidate|write|verify [-a address] [-n bytes] [-f image] [-o image] [-v]
+                          [-S socket] [-e eeprom]
+*/
+
+#include <stdio.h>
+#include <errno.h>		// Error number definitions
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>		// File control definitions
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>		// Unix sockets
+
+#include "bus_pirate.h"
+
+#define SOCKETNAME "/tmp/bus_pirate.sock"		 // Default Unix socket
+#define MAXCLIENTS 32					 // Most clients connected at once
+#define REQUESTLINE 64					 // Longest request line we accept
+#define REQUESTSIZE (REQUESTLINE + EEPROMMAX)		 // Room for a request line and its data
+#define OUTPUTSIZE (REQUESTLINE + EEPROMMAX)		 // Room for an answer line and its data
+
+#define OPREAD 0					 // Requests
+#define OPREVALIDATE 1
+#define OPWRITE 2
+#define OPVERIFY 3
+
+char *opnames[4] = {"read", "revalidate", "write", "verify"};
+const struct eepromprofile *profile = &profiles[0];	// -e:  the EEPROM on the bus
+
+// One client
+struct client {
+  int fd;					// -1 if the slot is free
+  char request[REQUESTSIZE];			// What we've received so far
+  int received;
+  int op;					// The request at the front of the buffer (once ready is set)
+  int address;
+  int length;
+  int size;					// Request line + data
+  int ready;					// 1 if the whole request is here
+  int hangup;					// 1 if we hang up once the output is gone (bad request)
+  char output[OUTPUTSIZE];			// The answer we're still sending
+  int sent;					// Output goes from sent to outputlength
+  int outputlength;
+};
+
+struct client clients[MAXCLIENTS];
+
+volatile sig_atomic_t stop = 0;
+
+// SIGINT or SIGTERM ... leave the event loop and put the Bus Pirate back in user mode
+void stopdaemon (int signal) {
+
+  (void) signal;
+  stop = 1;
+}
+
+// Look up a request name.  Returns OPREAD - OPVERIFY or -1 if we don't know it.
+int parseop (char *name) {
+
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (strcmp (name, opnames[i]) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Send all of length bytes (a short write just means the socket buffer is full).  Returns 0 or -1 on error.
+int sendall (int fd, char *data, int length) {
+
+  int done, result;
+
+  for (done = 0; done < length; done = done + result) {
+    result = send (fd, &data[done], length - done, MSG_NOSIGNAL);
+
+    if (result == -1) {
+      if (errno == EINTR) {
+        result = 0;
+        continue;
+      }
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Receive exactly length bytes.  Returns 0 or -1 on error (or if the other end hung up).
+int receiveall (int fd, char *data, int length) {
+
+  int done, result;
+
+  for (done = 0; done < length; done = done + result) {
+    result = recv (fd, &data[done], length - done, 0);
+
+    if (result == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (result == -1) {
+      if (errno == EINTR) {
+        result = 0;
+        continue;
+      }
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Put together an error answer from a library result
+void errormessage (struct buspirate *bp, int result, char *answer, int size) {
+
+  if (result == -1) {
+    snprintf (answer, size, "ERR %s\n", strerror (errno));
+  }
+  else if (bp->erroraddress != -1) {
+    snprintf (answer, size, "ERR %s (address %d)\n", bp->error, bp->erroraddress);
+  }
+  else {
+    snprintf (answer, size, "ERR %s\n", bp->error);
+  }
+}
+
+// Check whether the request at the front of the client's buffer is all here.  Returns 0 (ready or still waiting) or
+// -1 if it's garbage ... the client gets an error and is hung up on.
+int parserequest (struct client *client) {
+
+  char line[REQUESTLINE], name[16];
+  char *end;
+  int linelength;
+
+  client->ready = 0;
+  end = memchr (client->request, '\n', client->received);
+
+  if (end == NULL) {
+    return (client->received < REQUESTLINE) ? 0 : -1;
+  }
+
+  linelength = end - client->request + 1;
+
+  if (linelength > REQUESTLINE) {
+    return -1;
+  }
+
+  memcpy (line, client->request, linelength - 1);
+  line[linelength - 1] = '\0';
+
+  if ((sscanf (line, "%15s %d %d", name, &client->address, &client->length) != 3) ||
+      ((client->op = parseop (name)) == -1) || (client->address < 0) || (client->length < 1) ||
+      (client->length > EEPROMMAX) || (client->length > profile->size - client->address)) {
+    return -1;
+  }
+
+  client->size = linelength + (((client->op == OPWRITE) || (client->op == OPVERIFY)) ? client->length : 0);
+  client->ready = (client->received >= client->size);
+
+  return 0;
+}
+
+// Do what the request at the front of the client's buffer asks for and put the answer in its output buffer (see
+// flushclient).  Returns the library result (0, -1 or 1) ... -1 means the Bus Pirate went away.
+int serverequest (struct buspirate *bp, struct client *client) {
+
+  char *answer, *data;
+  int result, pages, skipped, n;
+
+  answer = client->output;
+  data = &client->request[client->size - client->length];
+  pages = 0;
+  skipped = 0;
+  n = 0;
+  client->sent = 0;
+
+  if (client->op == OPREAD) {
+    result = bpshadowread (bp, client->address, &answer[REQUESTLINE], client->length);
+  }
+  else if (client->op == OPREVALIDATE) {
+    result = bprevalidate (bp, client->address, &answer[REQUESTLINE], client->length);
+  }
+  else if (client->op == OPWRITE) {
+    // Differential write against the shadow copy ... reads the pages we don't know yet, skips the ones that match
+    result = bpshadowread (bp, client->address, &answer[REQUESTLINE], client->length);
+
+    if (result == 0) {
+      result = bpwriterange (bp, client->address, data, client->length, bp->shadow.data, &pages, &skipped);
+    }
+  }
+  else {
+    result = bprevalidate (bp, client->address, &answer[REQUESTLINE], client->length);
+  }
+
+  if (result != 0) {
+    errormessage (bp, result, answer, OUTPUTSIZE);
+    client->outputlength = strlen (answer);
+    return result;
+  }
+
+  if ((client->op == OPREAD) || (client->op == OPREVALIDATE)) {
+    // Put the line right in front of the data so it all goes out with one send
+    n = snprintf (answer, REQUESTLINE, "OK %d %04X\n", client->length, crc16 (&answer[REQUESTLINE], client->length));
+    memmove (&answer[REQUESTLINE - n], answer, n);
+    client->sent = REQUESTLINE - n;
+    client->outputlength = REQUESTLINE + client->length;
+    return 0;
+  }
+
+  if (client->op == OPWRITE) {
+    n = snprintf (answer, OUTPUTSIZE, "OK %d %d\n", pages - skipped, skipped);
+  }
+  else if (memcmp (&answer[REQUESTLINE], data, client->length) == 0) {
+    n = snprintf (answer, OUTPUTSIZE, "OK %04X\n", crc16 (data, client->length));
+  }
+  else {
+    for (n = 0; answer[REQUESTLINE + n] == data[n]; n++);
+    n = snprintf (answer, OUTPUTSIZE, "ERR Verify failed (address %d)\n", client->address + n);
+  }
+
+  client->outputlength = n;
+
+  return 0;
+}
+
+// Hang up on a client
+void dropclient (int epollfd, struct client *client) {
+
+  epoll_ctl (epollfd, EPOLL_CTL_DEL, client->fd, NULL);
+  close (client->fd);
+  client->fd = -1;
+  client->received = 0;
+  client->ready = 0;
+  client->hangup = 0;
+  client->sent = 0;
+  client->outputlength = 0;
+}
+
+// Tell epoll what we want to hear about:  input while there's room for it (and we're not hanging up) and room in the
+// socket while there's output left
+void watchclient (int epollfd, struct client *client) {
+
+  struct epoll_event event;
+
+  event.events = 0;
+  event.data.fd = client->fd;
+
+  if ((client->received < REQUESTSIZE) && (!client->hangup)) {
+    event.events = EPOLLIN;
+  }
+  if (client->sent < client->outputlength) {
+    event.events = event.events | EPOLLOUT;
+  }
+
+  epoll_ctl (epollfd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+// Send as much of the client's output as the socket takes right now (client sockets don't block).  Hangs up on the
+// client if it went away, or once the output is gone after a bad request.  Returns 0 or -1 if we hung up.
+int flushclient (int epollfd, struct client *client) {
+
+  int result;
+
+  while (client->sent < client->outputlength) {
+    result = send (client->fd, &client->output[client->sent], client->outputlength - client->sent, MSG_NOSIGNAL);
+
+    if ((result == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if ((result == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      break;
+    }
+    if (result == -1) {
+      dropclient (epollfd, client);
+      return -1;
+    }
+
+    client->sent = client->sent + result;
+  }
+
+  if (client->sent == client->outputlength) {
+    client->sent = 0;
+    client->outputlength = 0;
+  }
+
+  if ((client->hangup) && (client->outputlength == 0)) {
+    send (client->fd, "ERR Bad request\n", 16, MSG_NOSIGNAL);
+    dropclient (epollfd, client);
+    return -1;
+  }
+
+  watchclient (epollfd, client);
+
+  return 0;
+}
+
+// The daemon.  Returns the exit code.
+int daemonmain (char *port, int speed, char *socketname, char *statsfile, int keep) {
+
+  struct buspirate bp;
+  struct sockaddr_un address;
+  struct epoll_event event, events[MAXCLIENTS + 1];
+  struct client *client;
+  char *what;
+  int listenfd, epollfd, fd, count, result, i, j, next, served, waiting;
+
+  // Open the Bus Pirate and get it into I2C mode ... this is the only time we pay for it
+  result = bpstart (&bp, port, profile, speed, keep, &what);
+
+  if (result != 0) {
+    bpreport (&bp, result, what);
+    bpabort (&bp);
+    return (result == -1) ? 3 : 4;
+  }
+
+  bzero (&address, sizeof (address));
+  address.sun_family = AF_UNIX;
+  snprintf (address.sun_path, sizeof (address.sun_path), "%s", socketname);
+  unlink (socketname);
+
+  listenfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  epollfd = epoll_create1 (0);
+
+  if ((listenfd == -1) || (epollfd == -1) || (bind (listenfd, (struct sockaddr *) &address, sizeof (address)) == -1) ||
+      (listen (listenfd, MAXCLIENTS) == -1)) {
+    perror ("Could not set up the socket - ");
+    bpabort (&bp);
+    return 1;
+  }
+
+  event.events = EPOLLIN;
+  event.data.fd = listenfd;
+  epoll_ctl (epollfd, EPOLL_CTL_ADD, listenfd, &event);
+
+  for (i = 0; i < MAXCLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+
+  signal (SIGINT, stopdaemon);
+  signal (SIGTERM, stopdaemon);
+  fprintf (stderr, "%s:  listening on %s\n", port, socketname);
+
+  next = 0;
+
+  while (!stop) {
+    // Don't wait if somebody still has a request queued (and has read the last answer)
+    for (i = 0, waiting = 0; i < MAXCLIENTS; i++) {
+      waiting = waiting || ((clients[i].ready) && (clients[i].outputlength == 0));
+    }
+
+    count = epoll_wait (epollfd, events, MAXCLIENTS + 1, (waiting) ? 0 : -1);
+
+    if ((count == -1) && (errno != EINTR)) {
+      perror ("Event loop failed - ");
+      break;
+    }
+
+    for (i = 0; i < count; i++) {
+      if (events[i].data.fd == listenfd) {
+        fd = accept (listenfd, NULL, NULL);
+
+        for (j = 0; (fd != -1) && (j < MAXCLIENTS) && (clients[j].fd != -1); j++);
+
+        if ((fd != -1) && (j == MAXCLIENTS)) {
+          send (fd, "ERR Too many clients\n", 21, MSG_NOSIGNAL | MSG_DONTWAIT);
+          close (fd);
+        }
+        else if (fd != -1) {
+          fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+          clients[j].fd = fd;
+          clients[j].received = 0;
+          clients[j].ready = 0;
+          event.events = EPOLLIN;
+          event.data.fd = fd;
+          epoll_ctl (epollfd, EPOLL_CTL_ADD, fd, &event);
+        }
+        continue;
+      }
+
+      for (j = 0; (j < MAXCLIENTS) && (clients[j].fd != events[i].data.fd); j++);
+
+      if (j == MAXCLIENTS) {
+        continue;
+      }
+
+      client = &clients[j];
+
+      if ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && (flushclient (epollfd, client) == -1)) {
+        continue;
+      }
+
+      // A client with a full buffer has to wait for its turn (watchclient stops listening to it until then)
+      if ((client->received == REQUESTSIZE) || (client->hangup)) {
+        continue;
+      }
+
+      result = recv (client->fd, &client->request[client->received], REQUESTSIZE - client->received, 0);
+
+      if ((result == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+        continue;
+      }
+      if (result <= 0) {
+        dropclient (epollfd, client);
+        continue;
+      }
+
+      client->received = client->received + result;
+
+      if (parserequest (client) == -1) {
+        client->hangup = 1;
+      }
+
+      flushclient (epollfd, client);
+    }
+
+    // Serve one request from every client that has one, round robin starting after the last client we served first.
+    // A client that hasn't read its last answer yet waits ... its output buffer only holds one.
+    for (i = 0, served = -1; i < MAXCLIENTS; i++) {
+      client = &clients[(next + i) % MAXCLIENTS];
+
+      if ((client->fd == -1) || (!client->ready) || (client->outputlength > 0)) {
+        continue;
+      }
+
+      if (served == -1) {
+        served = (next + i) % MAXCLIENTS;
+      }
+
+      result = serverequest (&bp, client);
+
+      // Done with this request ... anything after it (a pipelined request) moves to the front of the buffer
+      memmove (client->request, &client->request[client->size], client->received - client->size);
+      client->received = client->received - client->size;
+
+      if (parserequest (client) == -1) {
+        client->hangup = 1;
+      }
+
+      flushclient (epollfd, client);
+
+      // The Bus Pirate went away (or stopped making sense) ... start over with a fresh connection and shadow copy.  If
+      // that doesn't work either, the port is dead (fd is -1) and we stop.
+      if (result == -1) {
+        fprintf (stderr, "%s:  lost the Bus Pirate (%s) ... reconnecting\n", port, strerror (errno));
+        bpabort (&bp);
+        result = bpstart (&bp, port, profile, speed, keep, &what);
+
+        if (result != 0) {
+          bpreport (&bp, result, what);
+          bpabort (&bp);
+          stop = 1;
+          break;
+        }
+      }
+    }
+
+    if (served != -1) {
+      next = (served + 1) % MAXCLIENTS;
+    }
+  }
+
+  for (i = 0; i < MAXCLIENTS; i++) {
+    if (clients[i].fd != -1) {
+      dropclient (epollfd, &clients[i]);
+    }
+  }
+
+  close (listenfd);
+  unlink (socketname);
+
+  // Back to user mode ... unless -k says to leave the Bus Pirate in I2C mode for whoever comes next.  Nothing to do if
+  // we lost the Bus Pirate and couldn't get it back (the port is already closed).
+  result = 0;
+
+  if (bp.fd == -1) {
+    result = -1;
+  }
+  else if (!keep) {
+    result = bpexitmode (&bp);
+
+    if (result != 0) {
+      bpreport (&bp, result, "Could not reset Bus Pirate to user mode");
+      bpabort (&bp);
+    }
+  }
+
+  bpclose (&bp);
+
+  if ((statsfile != NULL) && (bpwritestats (&bp, statsfile) == -1)) {
+    fprintf (stderr, "Could not write %s - %s\n", statsfile, strerror (errno));
+  }
+
+  return (result == 0) ? 0 : (result == -1) ? 3 : 4;
+}
+
+// Send one request and read the answer line (and the data for read and revalidate into data).  Returns 0, -1 on an
+// I/O error or 1 if the daemon said ERR (the answer line is in answer).
+int request (int fd, int op, int address, int length, char *data, char *answer, int size) {
+
+  char line[REQUESTLINE];
+  int n, i;
+
+  n = snprintf (line, sizeof (line), "%s %d %d\n", opnames[op], address, length);
+
+  if ((sendall (fd, line, n) == -1) ||
+      (((op == OPWRITE) || (op == OPVERIFY)) && (sendall (fd, data, length) == -1))) {
+    return -1;
+  }
+
+  // One byte at a time up to the new line ... the data (if any) comes right after it
+  for (i = 0; i < size - 1; i++) {
+    if (receiveall (fd, &answer[i], 1) == -1) {
+      return -1;
+    }
+    if (answer[i] == '\n') {
+      break;
+    }
+  }
+
+  answer[i] = '\0';
+
+  if (strncmp (answer, "OK", 2) != 0) {
+    return 1;
+  }
+
+  if (((op == OPREAD) || (op == OPREVALIDATE)) && (receiveall (fd, data, length) == -1)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// The client.  Returns the exit code.
+int clientmain (char *socketname, int op, int address, int length, char *imagefile, char *outputfile, int verify) {
+
+  struct sockaddr_un sockaddress;
+  char data[EEPROMMAX];
+  char answer[128];
+  const char *error;
+  FILE *out;
+  int fd, result, hex, size, first, imagelength;
+
+  if ((address < 0) || (address >= profile->size)) {
+    fprintf (stderr, "Address has to be inside the EEPROM (%d bytes)\n", profile->size);
+    return 1;
+  }
+
+  // Write and verify need the data first.  A raw binary file goes at -a.  Intel HEX records have their own addresses
+  // (that's what -c read -o writes), so the data goes where they say and -a doesn't go with them.
+  if ((op == OPWRITE) || (op == OPVERIFY)) {
+    if (imagefile == NULL) {
+      fprintf (stderr, "%s needs an image file (-f)\n", opnames[op]);
+      return 1;
+    }
+
+    hex = (imageformat (imagefile) == IMAGEHEX);
+
+    if ((hex) && (address != 0)) {
+      fprintf (stderr, "-a doesn't work with Intel HEX images ... the records say where the data goes\n");
+      return 1;
+    }
+
+    size = (hex) ? profile->size : profile->size - address;
+
+    if (size > (int) sizeof (data)) {
+      size = sizeof (data);
+    }
+
+    memset (data, 0xFF, sizeof (data));
+    result = imageload (imagefile, data, size, &first, &imagelength, &error);
+
+    if (result == -1) {
+      fprintf (stderr, "Could not read %s - %s\n", imagefile, strerror (errno));
+      return 1;
+    }
+    if (result == 1) {
+      printf ("%s:  %s\n", imagefile, error);
+      return 1;
+    }
+    if (error != NULL) {
+      fprintf (stderr, "Warning:  %s:  %s\n", imagefile, error);
+    }
+
+    // Send just the range the file covers
+    memmove (data, &data[first], imagelength - first);
+    address = first;
+    length = imagelength - first;
+  }
+
+  if ((length < 1) || (address < 0) || (address + length > profile->size)) {
+    fprintf (stderr, "Address and length have to be inside the EEPROM (%d bytes)\n", profile->size);
+    return 1;
+  }
+
+  bzero (&sockaddress, sizeof (sockaddress));
+  sockaddress.sun_family = AF_UNIX;
+  snprintf (sockaddress.sun_path, sizeof (sockaddress.sun_path), "%s", socketname);
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  if ((fd == -1) || (connect (fd, (struct sockaddr *) &sockaddress, sizeof (sockaddress)) == -1)) {
+    fprintf (stderr, "Unable to connect to %s - %s\n", socketname, strerror (errno));
+    return 1;
+  }
+
+  result = request (fd, op, address, length, data, answer, sizeof (answer));
+
+  if ((result == 0) && (op == OPWRITE) && (verify)) {
+    printf ("%s\n", answer);
+    result = request (fd, OPVERIFY, address, length, data, answer, sizeof (answer));
+  }
+
+  close (fd);
+
+  if (result == -1) {
+    fprintf (stderr, "Lost the daemon - %s\n", strerror (errno));
+    return 3;
+  }
+  if (result == 1) {
+    printf ("%s\n", answer);
+    return (strncmp (answer, "ERR Verify", 10) == 0) ? 5 : 4;
+  }
+
+  if ((op == OPREAD) || (op == OPREVALIDATE)) {
+    out = imagecreate (outputfile);
+
+    if ((out == NULL) || (imagewrite (out, imageformat (outputfile), address, data, length) == -1) ||
+        (imageclose (out, imageformat (outputfile)) == -1)) {
+      fprintf (stderr, "Could not write %s - %s\n", outputfile, strerror (errno));
+      return 3;
+    }
+  }
+  else {
+    printf ("%s\n", answer);
+  }
+
+  return 0;
+}
+
+int main (int argc, char *argv[]) {
+
+  // Define variables
+  int option, speed, op, address, length, verify, keep;
+  char *port, *socketname, *statsfile, *imagefile, *outputfile;
+
+  port = "/dev/ttyUSB0";
+  socketname = SOCKETNAME;
+  statsfile = NULL;
+  imagefile = NULL;
+  outputfile = "-";
+  speed = SPEEDDEFAULT;
+  op = -1;
+  address = 0;
+  length = -1;
+  verify = 0;
+  keep = 0;
+
+  // Check the command line options
+  //  -p:  serial port the Bus Pirate is attached to
+  //  -s:  I2C speed ... 5, 50, 100, 400 (kHz) or auto (find the fastest speed that works)
+  //  -j:  write round trip latencies and syscall counters to this file as JSON when the daemon stops (- is stdout)
+  //  -k:  leave the Bus Pirate in binary I2C mode when the daemon stops
+  //  -S:  Unix socket the daemon listens on (and the client connects to)
+  //  -c:  be a client and send this request (read, revalidate, write or verify)
+  //  -a, -n:  EEPROM address and number of bytes for read and revalidate (the whole EEPROM by default)
+  //  -f:  image file for write and verify (raw binary written at -a or Intel HEX ... .hex, written where its records
+  //       say)
+  //  -o:  image file for what we read (- is stdout)
+  //  -v:  verify after a write
+  //  -e:  EEPROM on the bus ... 24LC08B (the default), 24LC256 or 24LC512 (the client only uses it for the size)
+  while ((option = getopt (argc, argv, "p:s:j:kS:c:a:n:f:o:ve:")) != -1) {
+    switch (option) {
+      case 'e':
+        profile = parseprofile (optarg);
+        break;
+      case 'p':
+        port = optarg;
+        break;
+      case 's':
+        speed = parsespeed (optarg);
+
+        if (speed == -1) {
+          fprintf (stderr, "Unknown I2C speed:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'j':
+        statsfile = optarg;
+        break;
+      case 'k':
+        keep = 1;
+        break;
+      case 'S':
+        socketname = optarg;
+        break;
+      case 'c':
+        op = parseop (optarg);
+
+        if (op == -1) {
+          fprintf (stderr, "Unknown request:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'a':
+        address = atoi (optarg);
+        break;
+      case 'n':
+        length = atoi (optarg);
+        break;
+      case 'f':
+        imagefile = optarg;
+        break;
+      case 'o':
+        outputfile = optarg;
+        break;
+      case 'v':
+        verify = 1;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-p port] [-s 5|50|100|400|auto] [-j stats.json] [-k] [-S socket]\n"
+                 "       [-e 24LC08B|24LC256|24LC512]\n"
+                 "       %s -c read|revalidate|write|verify [-a address] [-n bytes] [-f image] [-o image] [-v]\n"
+                 "          [-S socket] [-e 24LC08B|24LC256|24LC512]\n", argv[0], argv[0]);
+        exit (1);
+    }
+  }
+
+  if (op != -1) {
+    exit (clientmain (socketname, op, address, ((length == -1) || (address + length > profile->size)) ?
+                      profile->size - address : length,
+                      imagefile, outputfile, verify));
+  }
+
+  exit (daemonmain (port, speed, socketname, statsfile, keep));
+}
@@ -0,0 +1,557 @@
+/*
+This program pretends to be a Bus Pirate with a 24LC08B EEPROM (or a 24LC256 or 24LC512 with -e) attached, so the
+other programs (and bus_pirate_bench.c) can be run and timed without any hardware.  It opens a pseudo-terminal, prints
+the name of the slave side (and makes a symlink to it with -l) and then answers on the master side just like the Bus
+Pirate would:
+
+ - User mode:  20 null bytes enter binary mode ... "BBIO1"
+ - Binary mode:  \0 ... "BBIO1", \1 ... "SPI1", \2 ... "I2C1", \xF ... 0x1 followed by the version banner (back to
+   user mode)
+ - SPI mode:  just enough to get out again ... \0 ... "BBIO1", \1 ... "SPI1", anything else ... 0x1
+ - I2C mode:  \0 ... "BBIO1" (back to binary mode), \1 ... "I2C1", start bit, stop bit, read byte, ACK, NACK, bulk
+   write (0x1 followed by an ACK or NACK for every byte), "write then read" (unless -n), power/pullups and speed ... 0x1
+
+The EEPROM is modeled too:  4 blocks of 256 bytes, page writes that wrap around inside their 16 byte page and a
+write cycle after every page write.  The 24LC256 and 24LC512 take 2 word address bytes (high byte first) and have 64
+and 128 byte pages.  The sizes, addressing and write cycle come from the library's profile table (see struct
+eepromprofile in bus_pirate.h), so a part added there works here too.  The EEPROM NACKs its device address until the
+write cycle is done, so ACK polling works just like it does on the real thing.
+
+Timing:  every byte we receive costs -b microseconds (87 by default ... 10 bits at 115200 baud) and every batch we
+receive costs another -u microseconds (the USB serial adapter's latency timer).  The answers don't go out until
+the modeled time has passed, so the other programs see about the same throughput they'd get from real hardware.
+With a -b under 87 (or -w over the part's write cycle) the ACK polls the writers queue run out before the write
+cycle does ... they send more polls on their own until the page is done (see streamwritecycle), so writes still work,
+just with more round trips.
+
+Usage:  bus_pirate_emulator [-l link] [-b byte usec] [-u usb usec] [-w write cycle usec] [-i image] [-o image] [-n]
+                           [-e 24LC08B|24LC256|24LC512]
+*/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <termios.h>		// POSIX terminal control definitions
+#include <errno.h>		// Error number definitions
+#include <fcntl.h>		// File control definitions
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include "bus_pirate.h"	// Just for the EEPROM profile table (and EEPROMMAX and PAGEMAX to go with it)
+
+#define INPUTSIZE 8192					 // Room for the commands we haven't been able to answer yet
+#define OUTPUTSIZE 16384				 // Room for the answers to one batch of commands
+#define BYTETIME 87					 // Microseconds per byte at 115200 baud (10 bits per byte)
+#define USBLATENCY 0					 // Microseconds of USB latency for every batch
+#define BANNER "Bus Pirate v3b\r\nFirmware v5.10 (r559)  Bootloader v4.4\r\n" \
+               "DEVID:0x0447 REVID:0x3046 (24FJ64GA002 B8)\r\nhttp://dangerousprototypes.com\r\nHiZ>"
+
+#define MODEUSER 0					 // Bus Pirate modes
+#define MODEBINARY 1
+#define MODEI2C 2
+#define MODESPI 3
+
+#define EEIDLE 0					 // EEPROM states ... what the next byte we get is
+#define EEDEVICE 1					 // Device address (right after a start bit)
+#define EEWORD 2					 // Word address
+#define EEDATA 3					 // Data bytes of a page write
+#define EEREAD 4					 // We're reading ... writes get a NACK
+
+// The 24LC08B (or whatever -e says)
+struct eeprom {
+  unsigned char memory[EEPROMMAX];
+  unsigned char page[PAGEMAX];			// Data of the page write we're working on (indexed by address in the page)
+  unsigned char written[PAGEMAX];		// 1 for every byte of the page we got data for
+  const struct eepromprofile *profile;		// Size, page size and addressing (sizes are powers of 2)
+  int state;
+  int wordbytes;				// Word address bytes we still need
+  int address;					// Address pointer
+  int writeaddress;				// Where the page write we're working on starts
+  int count;					// Number of data bytes in the page write
+  long long busyuntil;				// Modeled time (usec) when the write cycle is done
+  long pagewrites;
+};
+
+// The Bus Pirate
+struct emulator {
+  int master;
+  int mode;
+  int nulls;					// Null bytes in a row (user mode)
+  int bulkwrite;				// Bytes left in the current bulk write command
+  int bulkread;					// 1 if we support "write then read"
+  int bytetime;
+  int usblatency;
+  int writecycle;
+  long long clock;				// Modeled time in usec ... never behind the real time
+  unsigned char input[INPUTSIZE];
+  int inputlength;
+  unsigned char output[OUTPUTSIZE];
+  int outputlength;
+  struct eeprom ee;
+};
+
+volatile sig_atomic_t done = 0;
+
+void stop (int signal) {
+
+  (void) signal;
+  done = 1;
+}
+
+// Real time in microseconds
+long long now (void) {
+
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Queue bytes for the answer to the current batch.  Dropping some would only show up as a garbled response in
+// whatever program is talking to us, so an answer that doesn't fit stops the emulator right here.
+void answer (struct emulator *em, char *data, int length) {
+
+  if (em->outputlength + length > OUTPUTSIZE) {
+    fprintf (stderr, "Answer doesn't fit in the output buffer (%d bytes max) ... giving up\n", OUTPUTSIZE);
+    exit (3);
+  }
+
+  memcpy (&em->output[em->outputlength], data, length);
+  em->outputlength = em->outputlength + length;
+}
+
+// Send the whole answer to the current batch.  The pty only takes what fits in the other side's input queue, so keep
+// writing until it's all out.  Returns 0 or -1 on error.
+int sendanswer (struct emulator *em) {
+
+  int sent, result;
+
+  for (sent = 0; sent < em->outputlength; sent = sent + result) {
+    result = write (em->master, &em->output[sent], em->outputlength - sent);
+
+    if ((result == -1) && (errno == EINTR) && (!done)) {
+      result = 0;
+      continue;
+    }
+    if (result == -1) {
+      return (done) ? 0 : -1;		// SIGINT or SIGTERM ... we're quitting anyway
+    }
+  }
+
+  return 0;
+}
+
+// Start bit ... finish the page write we were working on (that's what a stop bit does too) and wait for a device address
+void eestart (struct emulator *em) {
+
+  struct eeprom *ee;
+  int i;
+
+  ee = &em->ee;
+
+  if ((ee->state == EEDATA) && (ee->count > 0)) {
+    for (i = 0; i < ee->profile->pagesize; i++) {
+      if (ee->written[i]) {
+        ee->memory[(ee->writeaddress & ~(ee->profile->pagesize - 1)) + i] = ee->page[i];
+      }
+    }
+
+    ee->busyuntil = em->clock + em->writecycle;
+    ee->pagewrites++;
+  }
+
+  ee->count = 0;
+  ee->state = EEDEVICE;
+}
+
+void eestop (struct emulator *em) {
+
+  eestart (em);
+  em->ee.state = EEIDLE;
+}
+
+// A byte written on the bus.  Returns 0 for an ACK, 1 for a NACK.
+int eewrite (struct emulator *em, unsigned char byte) {
+
+  struct eeprom *ee;
+
+  ee = &em->ee;
+
+  switch (ee->state) {
+    case EEDEVICE:
+      if ((em->clock < ee->busyuntil) || ((byte & 0xF0) != 0xA0) || ((ee->profile->words == 2) && ((byte & 0xE) != 0))) {
+        ee->state = EEIDLE;			// Busy with a write cycle or not our address ... NACK
+        return 1;
+      }
+
+      if (!(byte & 1)) {
+        ee->address = (byte >> 1) & ((1 << ee->profile->blockbits) - 1);	// Block from the device address (24LC08B)
+        ee->wordbytes = ee->profile->words;
+      }
+
+      ee->state = (byte & 1) ? EEREAD : EEWORD;
+      return 0;
+    case EEWORD:
+      ee->address = ((ee->address << 8) | byte) & (ee->profile->size - 1);
+
+      if (--ee->wordbytes > 0) {
+        return 0;
+      }
+
+      ee->writeaddress = ee->address;
+      ee->count = 0;
+      memset (ee->written, 0, ee->profile->pagesize);
+      ee->state = EEDATA;
+      return 0;
+    case EEDATA:
+      // The address wraps around inside the page ... more than a page of data overwrites the start of the page
+      ee->page[(ee->writeaddress + ee->count) & (ee->profile->pagesize - 1)] = byte;
+      ee->written[(ee->writeaddress + ee->count) & (ee->profile->pagesize - 1)] = 1;
+      ee->count++;
+      return 0;
+  }
+
+  return 1;
+}
+
+// A byte read from the bus ... the address pointer rolls over at the end of the EEPROM
+unsigned char eeread (struct emulator *em) {
+
+  unsigned char byte;
+
+  byte = em->ee.memory[em->ee.address];
+  em->ee.address = (em->ee.address + 1) % em->ee.profile->size;
+
+  return byte;
+}
+
+// Answer as many of the commands in the input as we can.  A command that isn't all here yet (like a "write then read"
+// that's missing some of its write bytes) stays in the input until the next batch.
+void process (struct emulator *em) {
+
+  unsigned char c, status;
+  int i, used, writecount, readcount;
+
+  for (used = 0; used < em->inputlength; used++) {
+    c = em->input[used];
+    em->clock = em->clock + em->bytetime;
+
+    if (em->mode == MODEUSER) {
+      em->nulls = (c == 0) ? em->nulls + 1 : 0;
+
+      if (em->nulls == 20) {
+        em->mode = MODEBINARY;
+        em->nulls = 0;
+        answer (em, "BBIO1", 5);
+      }
+    }
+    else if (em->mode == MODEBINARY) {
+      if (c == 0) {
+        answer (em, "BBIO1", 5);
+      }
+      else if (c == 1) {
+        em->mode = MODESPI;
+        answer (em, "SPI1", 4);
+      }
+      else if (c == 2) {
+        em->mode = MODEI2C;
+        answer (em, "I2C1", 4);
+      }
+      else if (c == 0xF) {
+        em->mode = MODEUSER;
+        answer (em, "\1", 1);
+        answer (em, BANNER, strlen (BANNER));
+      }
+      else {
+        answer (em, "\0", 1);
+      }
+    }
+    else if (em->mode == MODESPI) {
+      if (c == 0) {
+        em->mode = MODEBINARY;
+        answer (em, "BBIO1", 5);
+      }
+      else if (c == 1) {
+        answer (em, "SPI1", 4);
+      }
+      else {
+        answer (em, "\1", 1);
+      }
+    }
+    else if (em->bulkwrite > 0) {		// Data bytes of a bulk write
+      em->bulkwrite--;
+      status = eewrite (em, c);
+      answer (em, (char *) &status, 1);
+    }
+    else if (c == 0) {
+      em->mode = MODEBINARY;
+      answer (em, "BBIO1", 5);
+    }
+    else if (c == 1) {
+      answer (em, "I2C1", 4);
+    }
+    else if (c == 2) {
+      eestart (em);
+      answer (em, "\1", 1);
+    }
+    else if (c == 3) {
+      eestop (em);
+      answer (em, "\1", 1);
+    }
+    else if (c == 4) {
+      status = eeread (em);
+      answer (em, (char *) &status, 1);
+    }
+    else if ((c == 6) || (c == 7)) {
+      answer (em, "\1", 1);
+    }
+    else if ((c == 8) && (em->bulkread)) {
+      if ((em->inputlength - used < 5) ||
+          (em->inputlength - used < 5 + ((em->input[used + 1] << 8) | em->input[used + 2]))) {
+        em->clock = em->clock - em->bytetime;	// Wait for the rest of the command ... we'll count it then
+        break;
+      }
+
+      writecount = (em->input[used + 1] << 8) | em->input[used + 2];
+      readcount = (em->input[used + 3] << 8) | em->input[used + 4];
+
+      eestart (em);
+      status = 1;
+
+      for (i = 0; (i < writecount) && (status == 1); i++) {
+        if (eewrite (em, em->input[used + 5 + i]) != 0) {
+          status = 0;
+        }
+      }
+
+      answer (em, (char *) &status, 1);
+
+      for (i = 0; (status == 1) && (i < readcount); i++) {
+        c = eeread (em);
+        answer (em, (char *) &c, 1);
+      }
+
+      eestop (em);
+      em->clock = em->clock + (4 + writecount + readcount) * em->bytetime;
+      used = used + 4 + writecount;
+    }
+    else if ((c & 0xF0) == 0x10) {		// Bulk write ... 0x1 now, then an ACK/NACK for every byte
+      em->bulkwrite = (c & 0xF) + 1;
+      answer (em, "\1", 1);
+    }
+    else if (((c & 0xF0) == 0x40) || ((c & 0xF0) == 0x60) || ((c & 0xF0) == 0x70)) {
+      answer (em, "\1", 1);			// Power/pullups, speed, aux ... nothing to model
+    }
+    else if (c != 8) {
+      answer (em, "\0", 1);
+    }
+  }
+
+  memmove (em->input, &em->input[used], em->inputlength - used);
+  em->inputlength = em->inputlength - used;
+}
+
+// Load or save the EEPROM image.  Returns 0 or -1 on error.
+int loadimage (struct emulator *em, char *name) {
+
+  FILE *image;
+
+  image = fopen (name, "rb");
+
+  if (image == NULL) {
+    return -1;
+  }
+
+  fread (em->ee.memory, 1, em->ee.profile->size, image);
+  fclose (image);
+
+  return 0;
+}
+
+int saveimage (struct emulator *em, char *name) {
+
+  FILE *image;
+
+  image = fopen (name, "wb");
+
+  if (image == NULL) {
+    return -1;
+  }
+
+  fwrite (em->ee.memory, 1, em->ee.profile->size, image);
+
+  return fclose (image);
+}
+
+int main (int argc, char *argv[]) {
+
+  struct emulator *em;
+  struct pollfd pollopts;
+  struct termios portopts;
+  struct sigaction action;
+  char *link, *imagein, *imageout, *slavename;
+  int slave, option, result, wait;
+  long long arrival;
+
+  link = NULL;
+  imagein = NULL;
+  imageout = NULL;
+  em = calloc (1, sizeof (struct emulator));
+
+  if (em == NULL) {
+    perror ("Out of memory - ");
+    exit (1);
+  }
+
+  em->bulkread = 1;
+  em->bytetime = BYTETIME;
+  em->usblatency = USBLATENCY;
+  em->writecycle = -1;
+  em->ee.profile = &profiles[0];
+  memset (em->ee.memory, 0xFF, EEPROMMAX);	// A blank EEPROM is all 1s
+
+  // Check the command line options
+  //  -l:  make a symlink to the pty (like /tmp/ttyBP) so the other programs can use a fixed name
+  //  -b:  microseconds per byte, -u:  microseconds of USB latency per batch
+  //  -w:  write cycle in microseconds (the part's longest write cycle from the profile table by default)
+  //  -i:  load the EEPROM from a file, -o:  save the EEPROM to a file when we quit
+  //  -n:  old firmware ... no "write then read" command
+  //  -e:  EEPROM to model ... 24LC08B (the default), 24LC256 or 24LC512
+  while ((option = getopt (argc, argv, "l:b:u:w:i:o:ne:")) != -1) {
+    switch (option) {
+      case 'e':
+        em->ee.profile = parseprofile (optarg);
+        break;
+      case 'l':
+        link = optarg;
+        break;
+      case 'b':
+        em->bytetime = atoi (optarg);
+        break;
+      case 'u':
+        em->usblatency = atoi (optarg);
+        break;
+      case 'w':
+        em->writecycle = atoi (optarg);
+        break;
+      case 'i':
+        imagein = optarg;
+        break;
+      case 'o':
+        imageout = optarg;
+        break;
+      case 'n':
+        em->bulkread = 0;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-l link] [-b byte usec] [-u usb usec] [-w write cycle usec] [-i image]\n"
+                 "       [-o image] [-n] [-e 24LC08B|24LC256|24LC512]\n", argv[0]);
+        exit (1);
+    }
+  }
+
+  if (em->writecycle == -1) {
+    em->writecycle = em->ee.profile->writecycle;	// No -w ... the longest write cycle the part is allowed
+  }
+
+  if ((imagein != NULL) && (loadimage (em, imagein) == -1)) {
+    perror ("Could not load EEPROM image - ");
+    exit (1);
+  }
+
+  // Open the pseudo-terminal.  Keep the slave side open ourselves so the master doesn't see a hangup every time one of
+  // the other programs closes it.
+  em->master = posix_openpt (O_RDWR | O_NOCTTY);
+
+  if ((em->master == -1) || (grantpt (em->master) == -1) || (unlockpt (em->master) == -1)) {
+    perror ("Could not open pseudo-terminal - ");
+    exit (1);
+  }
+
+  slavename = ptsname (em->master);
+  slave = open (slavename, O_RDWR | O_NOCTTY);
+
+  if ((slave == -1) || (tcgetattr (slave, &portopts) == -1)) {
+    perror ("Could not open pseudo-terminal slave - ");
+    exit (1);
+  }
+
+  cfmakeraw (&portopts);
+  tcsetattr (slave, TCSANOW, &portopts);
+
+  if (link != NULL) {
+    unlink (link);
+
+    if (symlink (slavename, link) == -1) {
+      perror ("Could not create link to pseudo-terminal - ");
+      exit (1);
+    }
+  }
+
+  printf ("%s\n", slavename);
+  fflush (stdout);
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = stop;
+  sigaction (SIGINT, &action, NULL);
+  sigaction (SIGTERM, &action, NULL);
+
+  pollopts.fd = em->master;
+  pollopts.events = POLLIN;
+
+  while (!done) {
+    result = poll (&pollopts, 1, 500);
+
+    if (result <= 0) {
+      continue;
+    }
+
+    result = read (em->master, &em->input[em->inputlength], INPUTSIZE - em->inputlength);
+
+    if (result <= 0) {
+      continue;
+    }
+
+    // The batch can't start before it got here ... and the USB adapter holds on to it for a while
+    arrival = now ();
+
+    if (em->clock < arrival) {
+      em->clock = arrival;
+    }
+
+    em->clock = em->clock + em->usblatency;
+    em->inputlength = em->inputlength + result;
+    em->outputlength = 0;
+    process (em);
+
+    // Hold the answer until the modeled time has caught up
+    wait = em->clock - now ();
+
+    if (wait > 0) {
+      usleep (wait);
+    }
+
+    if (sendanswer (em) == -1) {
+      perror ("Could not send answer - ");
+      exit (3);
+    }
+  }
+
+  if ((imageout != NULL) && (saveimage (em, imageout) == -1)) {
+    perror ("Could not save EEPROM image - ");
+  }
+
+  if (link != NULL) {
+    unlink (link);
+  }
+
+  printf ("%ld page writes\n", em->ee.pagewrites);
+
+  return 0;
+}
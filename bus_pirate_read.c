@@ -1,538 +1,219 @@
 /* 
-This program uses the Bus Pirate to read data from an 24LC08B EEPROM.  This program uses Canonical input (default).  Canonical input
-offers no advantage for this program; it's just the default.
+This program uses the Bus Pirate to read data from an 24LC08B EEPROM (or a 24LC256 or 24LC512 with -e).  This
+program uses Canonical input (default).  Canonical input offers no advantage for this program; it's just the default.
+
+All the Bus Pirate code (serial port, modes, speeds, sequential and "write then read" bulk reads) lives in the
+shared library in bus_pirate.c ... this file is just the front-end.
 */ 
 
 #include <stdio.h>
-#include <unistd.h>
-#include <termios.h>		// POSIX terminal control definitions
 #include <errno.h>		// Error number definitions
-#include <fcntl.h>		// File control definitions
-#include <strings.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "bus_pirate.h"
+
 
-#define BUFFERSIZE 1024
-#define DEBUG
-#define BBEN "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"  // Send 20 null chars (\0) to ENABLE bitbang or binary mode
-#define I2CEN "\x2"			      	         // Send a STX char (\x2) to ENABLE I2C mode
-#define PPEN "\x4C"				         // Send a L char (\x4C) to enable power and pullup resistors
-#define STARTWRITE "\x2"				 // Send a start bit
-#define STOPWRITE "\x3"					 // Send a stop bit
-#define BULKWRITE1 "\x11"				 // Send the first bulk write command
-#define BULKWRITE2 "\x10"				 // Send the second bulk write command
-#define READWRITE "\x4"				         // Send a read byte command
-#define BBDIS "\xF"					 // Send a SI char (\xF) to DISABLE bitbang or binary mode
-#define I2CDIS "\0"					 // Send a null char (\0) to DISABLE I2C mode
-#define DEVWRITEADDR "\xA0"				 // Send the device write address ... see 24LC08B data sheet
-#define DEVREADADDR "\xA1"				 // Send the device read address ... see 24LC08B data sheet
-#define NACKWRITE "\x7"					 // Send a NACK
-
-int main (void) {
+char *statsfile = NULL;				// -j:  where to write the JSON summary
+char *partialfile = NULL;			// -o image file we haven't finished yet
+
+// Remove the image file if we exit before it's finished (bpfail, bpquit ...) ... half an EEPROM looks like a whole one
+void removepartial (void) {
+
+  if (partialfile != NULL) {
+    unlink (partialfile);
+  }
+}
+
+int main (int argc, char *argv[]) {
 
   // Define variables
-  int fd, result, i, readaddress;
-  struct termios portopts;
-  char BPbuffer[BUFFERSIZE];
-  char outputbuffer[BUFFERSIZE];
-  char addressbuffer[1];
-
-  result = 0;
-  readaddress = 0;
-  addressbuffer[0] = readaddress;
-
-  // Open the serial port.  The Bus Pirate will be attached as /dev/ttyUSB0.  Open the port with R/W, no delay and "no controlling
-  // terminal" options.  The latter option will keep unwanted keyboard abort signals from affecting this program.
-  fd = open ("/dev/ttyUSB0",O_RDWR | O_NOCTTY | O_NDELAY);
-
-  if (result == -1) {
-    perror ("Unable to open /dev/ttyUSB0 - ");
-    exit(1);
+  int result, i, j, option, speed, framed, length, crc, keep, burst;
+  struct buspirate bp;
+  char *port, *imagefile, *what;
+  FILE *image;
+  const struct eepromprofile *profile;
+  char outputbuffer[EEPROMMAX + 1];	// Room for the whole EEPROM + the null at the end
+
+  speed = SPEEDDEFAULT;
+  profile = &profiles[0];
+  port = "/dev/ttyUSB0";
+  keep = 0;
+  imagefile = NULL;
+  framed = 0;
+  length = 0;
+  image = NULL;
+  bzero (outputbuffer, sizeof (outputbuffer));
+
+  // Check the command line options
+  //  -s:  I2C speed ... 5, 50, 100, 400 (kHz) or auto (find the fastest speed that works)
+  //  -p:  serial port the Bus Pirate is attached to (like the pty from bus_pirate_emulator)
+  //  -k:  keep the Bus Pirate in binary I2C mode when we're done (the next program doesn't have to wait for it)
+  //  -j:  write round trip latencies and syscall counters to this file as JSON when we're done (- is stdout)
+  //  -o:  save the whole EEPROM to this image file (raw binary or Intel HEX ... .hex, - is stdout)
+  //  -H:  framed image ... read the length and CRC header and then exactly that much data (see framebuild)
+  //  -e:  EEPROM on the bus ... 24LC08B (the default), 24LC256 or 24LC512
+  while ((option = getopt (argc, argv, "Hs:p:j:o:ke:")) != -1) {
+    switch (option) {
+      case 'e':
+        profile = parseprofile (optarg);
+        break;
+      case 's':
+        speed = parsespeed (optarg);
+
+        if (speed == -1) {
+          fprintf (stderr, "Unknown I2C speed:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'p':
+        port = optarg;
+        break;
+      case 'k':
+        keep = 1;
+        break;
+      case 'j':
+        statsfile = optarg;
+        break;
+      case 'o':
+        imagefile = optarg;
+        break;
+      case 'H':
+        framed = 1;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-k] [-s 5|50|100|400|auto] [-p port] [-j stats.json] [-o image] [-H]\n"
+                 "       [-e 24LC08B|24LC256|24LC512]\n", argv[0]);
+        exit (1);
+    }
   }
 
-  // Change the serial device (fd) flags ... clear all flags ... a brute force way to clear the O_NDELAY flag so
-  // that the program will block and wait for input from serial device before executing read.  Otherwise, the Bus
-  // Pirate will not be able to process the write and send input to read fast enough.
+  // Open the serial port (/dev/ttyUSB0 unless -p says otherwise), enter binary I2C mode, find out if the firmware
+  // supports the I2C "write then read" command (0x08) and set the I2C bus speed (-s) ... see bpstart.  With "write then
+  // read", bpreadrange reads a complete block in a single round trip.
   //
-  // Note:  Hmmm ... even though all flags are cleared, I'm still having problems reading the input from serial
-  // device when the Bus Pirate is connected to USB port on docking station.  Add a usleep to each read to introduce
-  // a delay before we read.
-  result =  fcntl(fd, F_SETFL, 0);
-
-  if (result == -1) {
-    perror("Cannot set serial device flag - ");
-    close (fd);
-    exit(7);
-  } 
-
-  // Set serial port options for the Bus Pirate.  Use the termios structure (available in termios.h) and it's associated
-  // constants to set the options.  Before you can set the options, you have to initialize your portopts structure by
-  // getting the existing port options.  The options don't take effect until you call tcsetattr.  Use the TCSANOW constant
-  // to set the settings IMMEDIATELY. Unlike speed, there is no function to set the character size and parity.  Just use
-  // bit masking to set these settings (8N1).
-  tcgetattr (fd, &portopts);
-  memset (&portopts, 0, sizeof(struct termios)); // Initialize all elements of the portopts structure to 0
-  cfsetspeed (&portopts,B115200);
-  tcsetattr (fd, TCSANOW, &portopts);
-  portopts.c_cflag &= ~PARENB;	// Disable parity bit ... note the use of bitwise NOT (~) in front of constant
-  portopts.c_cflag &= ~CSTOPB;  // Disable 2 stop bits ... use 1 stop instead ... note the use of bitwise NOT as above
-  portopts.c_cflag &= ~CSIZE;   // Clear the existing character size bits ... again ... note the use of bitwise NOT
-  portopts.c_cflag &= CS8;      // Set the mask bits for 8 characters
-
-  for (i=0; i<(sizeof(outputbuffer)); i++) {
-
-    // Put the Bus Pirate in "bitbang" or binary mode.  Send the ASCII "null" (\0 or \x0) 20 times to get into binary
-    // mode.  The Bus Pirate will answer with "BBIO1".
-    result = write(fd, BBEN, 20); 
-     
-    if (result == -1) {
-      perror("Cannot send bitbang command to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
-  
-    usleep (10000);
-    result = read(fd, &BPbuffer, 5);
-  
-    if (result <= 0 ) {
-      perror("Could not read bitbang output from Bus Pirate - ");
-      close (fd);
-      exit (3);
-    }
+  // Note:  I was having problems reading the input from serial device when the Bus Pirate is connected to USB port on
+  // docking station.  Don't trust a single read ... the library waits (with poll) until all the bytes we expect have
+  // arrived.
+  //
+  // Enter binary I2C mode once for the whole dump.  The Bus Pirate stays in I2C mode (power and pullups on) while
+  // we read every byte and is only reset back to user mode after the loop.  Re-entering BBIO1/I2C1 for each byte
+  // (and draining the version banner each time) was by far the slowest part of this program.  -k last time too?
+  // Then it's probably still in I2C mode and we ask first.
+  result = bpstart (&bp, port, profile, speed, keep, &what);
+
+  if (result != 0) {
+    bpfail (&bp, result, what, statsfile);
+  }
 
-    if (strncmp("BBIO1", BPbuffer, 5) != 0) {
-      puts ("Could not enable binary mode on Bus Pirate");
-      close (fd);
-      exit (4);
-    }
-  
-    // Put the Bus Pirate in "I2C"  mode.  Bus Pirate will answer with "I2C1".
-    result = write(fd, I2CEN, 1);
-   
-    if (result == -1) {
-      perror("Cannot send I2C command to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
-
-    usleep (10000);   
-    result = read(fd, &BPbuffer, 4);
-  
-    if (result <= 0 ) {
-      perror("Could not read I2C output from Bus Pirate - ");
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3);
-    }
-  
-    if (strncmp("I2C1", BPbuffer, 4) != 0) {
-      puts("Could not enable I2C mode on Bus Pirate");
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
-  
-    // Configure the Bus Pirate peripherals (W:  Power on, P:  Pullups on):  01001100 ... 0x4C ... see I2C (binary) - DP for details
-    // Bus Pirate will return 0x1 when peripherals on enabled
-    result = write(fd, PPEN, 1);
-   
-    if (result == -1) {
-      perror("Cannot send peripherals command to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
-
-    usleep (10000);   
-    result = read(fd, &BPbuffer, 1);
-  
-    if (result <= 0 ) {
-      perror("Could not read peripherals output from Bus Pirate - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3);
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts("Could not enable peripherals mode on Bus Pirate");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
-  
-    // Read the data from the EEPROM.  This is an 24LC08B.  It uses following addresses for read:
-    // 0xA1
-    // Here is the read instruction:  [10100000 0 [10100001 r].
-    // 
-    // So here's how this works:
-    //  - Send the start bit
-    //  - Send the first bulk write command which specifies the number of bytes to write:  2 ... device write address, address
-    //  - Send the device write address
-    //  - Send the read address
-    //  - Send another start bit
-    //  - Send another bulk write command which specifies the number of bytes to write:  1 ... device read address
-    //  - Send the device read address
-    //  - Send the read command to read a byte
-    //  - Send a NACK
-    //  - Send a stop bit
-    //  - Repeat
-
-    // Send I2C start bit
-    result = write (fd, STARTWRITE, 1);
-  
-    if (result == -1) {
-      perror ("Could not send start bit to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
+  // Framed image (-H) ... read the header, then the data in one sequential burst.  No need to look for the EOD marker
+  // ... we know exactly how much there is and the data can hold any byte.
+  if (framed) {
+    result = bpreadrange (&bp, 0, outputbuffer, FRAMEHEADERSIZE);
 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - start bit - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts("Start bit error on Bus Pirate");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
-  
-    // Send first I2C bulk write command 17 (10001) ... 16 (10000) for the bulk write command + 1 (1) to write 2 bytes ... yes ... 1
-    // is 2 ... see documentation.  Those 2 bytes are:  device address, write address (changes each time through loop)
-    result = write (fd, BULKWRITE1, 1);
-  
-    if (result == -1) {
-      perror ("Could not send bulk write to EEPROM - ");
-      close (fd); 
-      exit (2);
+    if (result != 0) {
+      bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
     }
- 
-    usleep (10000); 
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - bulk write command - ");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts ("Bulk write error on Bus Pirate");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
-    
-    // Send the device write address
-    result = write (fd, DEVWRITEADDR, 1);
-  
-    if (result == -1) {
-      perror ("Could not send device address to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
- 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - device address write command - ");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 == BPbuffer[0]) {    // Unlike our previous responses ... a 1 in the buffer means a NACK ... something went wrong
-      puts ("Device address write error on Bus Pirate - NACK");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
+
+    if ((frameparse (outputbuffer, &length, &crc) != 0) || (length > profile->size - FRAMEHEADERSIZE)) {
+      puts ("No framed image in the EEPROM");
+      bpquit (&bp, 4, statsfile);
     }
 
-    // Send the read address
-    result = write (fd, &addressbuffer, 1);
-   
-    readaddress++; 
-    addressbuffer[0] = readaddress;
+    result = bpreadrange (&bp, FRAMEHEADERSIZE, outputbuffer, length);
 
-    if (result == -1) {
-      perror ("Could not send read address to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
-  
-    usleep (10000);
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - read address write command - ");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 == BPbuffer[0]) {
-      puts("Read address write error on Bus Pirate");    // Same here ... 1 means a NACK
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
+    if (result != 0) {
+      bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
     }
 
-    // Send another I2C start bit
-    result = write (fd, STARTWRITE, 1);
-  
-    if (result == -1) {
-      perror ("Could not send start bit to EEPROM - ");
-      close (fd); 
-      exit (2);
+    if (crc16 (outputbuffer, length) != crc) {
+      printf ("Framed image CRC error (%04X, header says %04X)\n", crc16 (outputbuffer, length), crc);
+      bpquit (&bp, 5, statsfile);
     }
+  }
 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - start bit - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts("Start bit error on Bus Pirate");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
-  
-    // Send second I2C bulk write command 16 (10000) ... 16 (10000) for the bulk write command + 0 (0) to write 1 bytes ... yes ... 0
-    // is 1 ... see documentation.  The 1 byte is:  device read address
-    result = write (fd, BULKWRITE2, 1);
-  
-    if (result == -1) {
-      perror ("Could not send bulk write to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
- 
-    usleep (10000); 
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - bulk write command - ");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts ("Bulk write error on Bus Pirate");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
+  // With -o, open the image file now so every block goes into it as soon as we've read it.  A framed image has been
+  // checked by now ... a bad frame doesn't leave an empty file behind.  Until it's closed the file is partial and
+  // goes away if we bail out (see removepartial).
+  if (imagefile != NULL) {
+    image = imagecreate (imagefile);
 
-    // Send the device read address
-    result = write (fd, DEVREADADDR, 1);
-  
-    if (result == -1) {
-      perror ("Could not send device address to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
- 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - device address write command - ");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
+    if (image == NULL) {
+      fprintf (stderr, "Could not create %s - %s\n", imagefile, strerror (errno));
+      bpquit (&bp, 1, statsfile);
     }
-  
-    if (1 == BPbuffer[0]) {    // Unlike our previous responses ... a 1 in the buffer means a NACK ... something went wrong
-      puts ("Device address write error on Bus Pirate - NACK");
-      result = write (fd, STOPWRITE, 1);
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
+
+    if (image != stdout) {
+      partialfile = imagefile;
+      atexit (removepartial);
     }
+  }
 
-    // Send read command ... copy the byte into the output buffer.  Also, check for our "EOD" marker (0xA ... new line) and 
-    // break out of the loop when you find it
-    result = write (fd, READWRITE, 1);
-  
-    if (result == -1) {
-      perror ("Could not send read to EEPROM - ");
-      close (fd); 
-      exit (2);
+  // Read the data from the EEPROM a burst at a time (a 256 byte block on the 24LC08B ... the block number goes in the
+  // device address, see deviceaddress).  Stop after the burst that holds our "EOD" marker (0xA ... new line) ...
+  // there's nothing we care about after it.  An image file gets the whole EEPROM.
+  burst = profile->burst;
+
+  for (i = 0; (!framed) && (i < profile->size); i = i + burst) {
+    result = bpreadrange (&bp, i, &outputbuffer[i], burst);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
     }
 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
-    outputbuffer[i] = BPbuffer[0];
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - read - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
+    if (image != NULL) {
+      if (imagewrite (image, imageformat (imagefile), i, &outputbuffer[i], burst) == -1) {
+        bpfail (&bp, -1, "Could not write image file", statsfile);
+      }
+      continue;
     }
 
-    if (10 == BPbuffer[0]) {
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
+    for (j = i; (j < i + burst) && (outputbuffer[j] != 10); j++);
+
+    if (j < i + burst) {
+      outputbuffer[j + 1] = '\0';	// Everything after the EOD marker is junk
       break;
     }
+  }
 
-    // Send NACK 
-    result = write (fd, NACKWRITE, 1);
-  
-    if (result == -1) {
-      perror ("Could not send NACK to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
+  // Disable I2C mode and binary mode ... put the Bus Pirate back into user mode.  With -k leave it in I2C mode (power
+  // and pullups on) so the next program gets going with a single round trip (see bpentermode).
+  if (!keep) {
+    result = bpexitmode (&bp);
 
-    usleep (10000);  
-    result = read (fd, &BPbuffer, 1);
- 
-    if (result != 1) { 
-      perror ("Could not read I2C response - NACK - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3); 
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts("NACK error on Bus Pirate");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
+    if (result != 0) {
+      bpfail (&bp, result, "Could not reset Bus Pirate to user mode", statsfile);
     }
+  }
 
-    // Send I2C stop bit
-    result = write (fd, STOPWRITE, 1);
-  
-    if (result == -1) {
-      perror ("Could not send stop bit to EEPROM - ");
-      close (fd); 
-      exit (2);
-    }
-  
-    usleep (10000);
-    result = read (fd, &BPbuffer, 1);
-  
-    if (result != 1) { 
-      perror ("Could not read I2C response - stop bit - ");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (3);
-    }
-  
-    if (1 != BPbuffer[0]) {
-      puts("Stop bit write error on Bus Pirate");
-      result = write (fd, I2CDIS, 1);
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
- 
-    // Disable I2C mode ... put the Bus Pirate back into bitbang mode
-    result = write(fd, I2CDIS, 1);
-   
-    if (result == -1) {
-      perror("Cannot send bitbang command to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
-
-    usleep (10000);
-    result = read(fd, &BPbuffer, 5);
-
-    if (result <= 0 ) {
-      perror("Could not read bitbang output from Bus Pirate - ");
-      close (fd);
-      exit (3);
-    }
+  // Close the serial port
+  bpclose (&bp);
 
-    if (strncmp("BBIO1", BPbuffer, 5) != 0) {
-      puts("Could not disable I2C mode on Bus Pirate");
-      result = write (fd, BBDIS, 1);
-      close (fd);
-      exit (4); 
-    }
+  if ((statsfile != NULL) && (bpwritestats (&bp, statsfile) == -1)) {
+    fprintf (stderr, "Could not write %s - %s\n", statsfile, strerror (errno));
+  }
 
-    // Disable binary mode ... put the Bus Pirate back into user mode ... aka reset
-    result = write(fd, BBDIS, 1);
-   
-    if (result == -1) {
-      perror("Cannot send reset command to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
-
-    usleep (10000);
-    result = read(fd, &BPbuffer, 1);
-
-    if (result <= 0 ) {
-      perror("Could not read reset output from Bus Pirate - ");
-      close (fd);
+  // Finish the image file ... or print the output buffer on the screen.  Framed data goes out exactly as it is (it
+  // doesn't have to be text).
+  if ((framed) && (image != NULL) && (imagewrite (image, imageformat (imagefile), 0, outputbuffer, length) == -1)) {
+    fprintf (stderr, "Could not write %s - %s\n", imagefile, strerror (errno));
+    exit (3);
+  }
+
+  if (image != NULL) {
+    if (imageclose (image, imageformat (imagefile)) == -1) {
+      fprintf (stderr, "Could not write %s - %s\n", imagefile, strerror (errno));
       exit (3);
     }
-    if (1 != BPbuffer[0]) {
-      puts("Could not reset Bus Pirate");
-      close (fd);
-      exit (4); 
-    }
 
-    // Once back in user mode, the Bus Pirate will print hardware and firmware version ... read this output before
-    // trying to enter binary mode again.  And yes, it takes 2 reads to read this output.
-    usleep (10000);
-    result = read(fd, &BPbuffer, 132);
-    usleep (10000);
-    result = read(fd, &BPbuffer, 132);
+    partialfile = NULL;
+  }
+  else if (framed) {
+    fwrite (outputbuffer, 1, length, stdout);
+  }
+  else {
+    printf ("%s\n", outputbuffer);
   }
-
-  // Close the serial port
-  close (fd);
-
-  // Print the output buffer on the screen
-  printf ("%s\n", outputbuffer);
 
 }
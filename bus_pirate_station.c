@@ -0,0 +1,718 @@
+/*
+Programming station:  drive a whole bunch of Bus Pirates (each with its own 24LC08B ... or whatever -e says, they all
+have to be the same kind) at once from a single process.
+Give it the serial ports on the command line and it writes the same data to every EEPROM (and verifies it with -v),
+or reads all of them with -r (and saves every EEPROM to its own image file with -o).
+
+Every Bus Pirate gets its own little state machine:  mode probe (-k), drain, nulls, mode entry, speed, (differential
+or verify) read, page writes, verify read, mode exit and the version banner.  Each step sends its commands and returns
+right away (the drain and the nulls just set a deadline for the loop) ... a single epoll loop waits for whichever Bus
+Pirate answers next (or whose deadline comes up), checks the response right in that Bus Pirate's receive ring and
+sends the next batch.  While one EEPROM is busy with its write cycles the others keep going, so the station gets
+faster with every programmer you plug in instead of every terminal you open.
+
+The steps are the same ones the other programs use (see bus_pirate.c):  planned page writes with their ACK polls go
+out STREAMPAGES at a time in a command stream, and reads are sequential reads in command streams.  We don't probe for
+"write then read" and -s auto isn't supported ... both of those need blocking round trips.
+
+Usage:  bus_pirate_station [-r] [-d] [-v] [-s 5|50|100|400] [-j stats prefix] [-o image prefix] [-f image] [-H] [-k]
+                          [-e 24LC08B|24LC256|24LC512] port [port ...]
+*/
+
+#include <stdio.h>
+#include <errno.h>		// Error number definitions
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "bus_pirate.h"
+
+#define MAXSTATIONS 64					 // Most Bus Pirates we'll drive at once
+#define VERIFYRETRIES 3					 // Number of times to rewrite bad pages before we give up
+#define NULLWAIT 1					 // Milliseconds between nulls (bpsendnulls waits for each one to go out)
+
+#define STATIONPROBE 0					 // Where a Bus Pirate is in its state machine
+#define STATIONNULLS 1					 // Waiting for "BBIO1"
+#define STATIONMODE 2
+#define STATIONSPEED 3
+#define STATIONREAD 4					 // Reading the EEPROM (-r or -d)
+#define STATIONWRITE 5
+#define STATIONVERIFY 6
+#define STATIONEXIT 7
+#define STATIONBANNER 8					 // Waiting for the version banner to stop
+#define STATIONDRAIN 9					 // Waiting for leftovers to stop before the nulls
+#define STATIONDONE 10
+#define STATIONFAILED 11
+
+// One Bus Pirate
+struct station {
+  struct buspirate bp;
+  char *port;
+  int state;
+  char *expected;				// Response we expect for mode entry, speed and mode exit
+  int expectedlength;
+  int done;					// Bytes of the read we've queued so far
+  struct writerange write;			// Where the write is (see streamnextwrite)
+  int usecurrent;				// 1 to skip pages that already match current (differential write or rewrite)
+  int tries;					// Verify passes
+  int modetries;				// Mode entries (we try twice ... see bpentermode)
+  int nulls;					// Nulls we've sent for this mode entry
+  int pages;
+  int skipped;
+  long long sent;				// When we sent the current step (usec) ... for the latency histograms
+  long long deadline;				// When we give up waiting for the Bus Pirate (usec)
+  long long started;
+  long long finished;
+  char current[EEPROMMAX];			// What's in the EEPROM (read, differential and verify)
+};
+
+char image[EEPROMMAX + 1];			// What we write to every EEPROM
+int imagelength;
+int readonly = 0;
+int differential = 0;
+int verify = 0;
+int speed = SPEEDDEFAULT;
+int framed = 0;
+int keep = 0;
+const struct eepromprofile *profile = &profiles[0];
+
+// Give up on a Bus Pirate.  Leave it in a sane state (as far as we can) and close the port ... that takes it out of
+// the epoll set too.
+void stationfail (struct station *st, const char *error, int address) {
+
+  if (st->bp.error == NULL) {
+    st->bp.error = error;
+    st->bp.erroraddress = address;
+  }
+
+  bpabort (&st->bp);
+  st->state = STATIONFAILED;
+  st->finished = bpmicros ();
+}
+
+// Send a simple step (mode entry, speed or mode exit) and remember what the answer should be
+int stationsimple (struct station *st, int state, char *command, int length, char *expected, int expectedlength) {
+
+  st->state = state;
+  st->expected = expected;
+  st->expectedlength = expectedlength;
+  st->sent = bpmicros ();
+
+  return bpsend (&st->bp, command, length);
+}
+
+// Queue and send the next batch of the read or write we're working on (a busy page gets its ACK polls again first ...
+// see streamnextwrite).  A batch where every page was skipped doesn't go out at all ... we just move on to the next
+// one.  Returns 0 if a batch went out, 1 if this read or write is done or -1 on an error.
+int stationbatch (struct station *st) {
+
+  struct commandstream *stream;
+  int count, length;
+
+  stream = &st->bp.stream;
+  length = (readonly) ? profile->size : imagelength;
+
+  while ((st->state == STATIONWRITE) ? WRITEPENDING (&st->write) : (st->done < length)) {
+    if (st->state == STATIONWRITE) {
+      count = streamnextwrite (stream, &st->write);
+    }
+    else {
+      streamreset (stream);
+      count = streamqueueread (stream, st->done, &st->current[st->done], length - st->done);
+      st->done = st->done + count;
+    }
+
+    if ((count == -1) || ((count == 0) && (stream->count == 0))) {	// Doesn't fit ... should never happen
+      errno = ENOBUFS;
+      return -1;
+    }
+
+    if (stream->count > 0) {
+      st->sent = bpmicros ();
+      return bpsend (&st->bp, stream->command, stream->commandlength);
+    }
+  }
+
+  streamreset (stream);
+
+  return 1;
+}
+
+void stationnext (struct station *st);
+
+// Start a read or write phase (STATIONREAD, STATIONWRITE or STATIONVERIFY) from the beginning.  If there's nothing to
+// do in it, move right on to the next step.
+void stationphase (struct station *st, int state) {
+
+  int result;
+
+  st->state = state;
+  st->done = 0;
+
+  // Rewrites after a failed verify don't count pages again
+  streamwritestart (&st->write, 0, image, (state == STATIONWRITE) ? imagelength : 0, (st->usecurrent) ? st->current :
+                    NULL, (st->tries == 0) ? &st->pages : NULL, (st->tries == 0) ? &st->skipped : NULL);
+  result = stationbatch (st);
+
+  if (result == -1) {
+    stationfail (st, strerror (errno), -1);
+  }
+  else if (result == 1) {
+    stationnext (st);
+  }
+}
+
+// The step we were on finished OK ... figure out what comes next and send it
+void stationnext (struct station *st) {
+
+  char command[1];
+  int i, j;
+
+  switch (st->state) {
+    case STATIONPROBE:
+    case STATIONNULLS:
+    case STATIONMODE:
+      if (speed != SPEEDDEFAULT) {
+        command[0] = SPEEDCMD | speed;
+
+        if (stationsimple (st, STATIONSPEED, command, 1, "\1", 1) == -1) {
+          stationfail (st, strerror (errno), -1);
+        }
+        return;
+      }
+
+      // No speed to set ... start reading or writing right away
+      // Fall through
+    case STATIONSPEED:
+      if ((readonly) || (differential)) {
+        stationphase (st, STATIONREAD);
+      }
+      else {
+        stationphase (st, STATIONWRITE);
+      }
+      return;
+    case STATIONREAD:
+      if (readonly) {
+        break;
+      }
+
+      st->usecurrent = 1;
+      stationphase (st, STATIONWRITE);
+      return;
+    case STATIONWRITE:
+      if (verify) {
+        stationphase (st, STATIONVERIFY);
+        return;
+      }
+      break;
+    case STATIONVERIFY:
+      if (memcmp (st->current, image, imagelength) == 0) {
+        break;
+      }
+
+      if (st->tries++ == VERIFYRETRIES) {
+        stationfail (st, "Verify failed ... giving up", -1);
+        return;
+      }
+
+      // Report the bad pages and write just those again (a differential write against what we read back)
+      for (i = 0; i < imagelength; i = i + j) {
+        j = planwrite (profile, i, imagelength - i);
+
+        if (memcmp (&st->current[i], &image[i], j) != 0) {
+          printf ("%s:  verify failed for page at address %d (%d bytes) ... rewriting\n", st->port, i, j);
+        }
+      }
+
+      st->usecurrent = 1;
+      stationphase (st, STATIONWRITE);
+      return;
+    case STATIONEXIT:
+      st->state = STATIONBANNER;
+      st->deadline = bpmicros () + BANNERTIMEOUT * 1000LL;
+      return;
+  }
+
+  // Everything is done ... leave the Bus Pirate in I2C mode (-k) or put it back into user mode
+  if (keep) {
+    bpclose (&st->bp);
+    st->state = STATIONDONE;
+    st->finished = bpmicros ();
+    return;
+  }
+
+  if (stationsimple (st, STATIONEXIT, MODEEXIT, 2, "BBIO1\1", 6) == -1) {
+    stationfail (st, strerror (errno), -1);
+  }
+}
+
+// "BBIO1" is in the receive ring ... throw it away along with anything in front of it and send I2C mode, power and
+// pullups (I2CRESUME).  The mode entry time still counts from the first null (or the probe).
+void stationresume (struct station *st, int found) {
+
+  st->bp.rx.tail = st->bp.rx.tail + found + 5;
+  st->state = STATIONMODE;
+  st->expected = "I2C1\1";
+  st->expectedlength = 5;
+
+  if (bpsend (&st->bp, I2CRESUME, 2) == -1) {
+    stationfail (st, strerror (errno), -1);
+  }
+}
+
+// Send the next null (see bpsendnulls).  They go out NULLWAIT ms apart ... the loop sends the next one when the
+// deadline comes around and stationreceive moves on as soon as "BBIO1" shows up.  After the last one we give the
+// answer RESPONSETIMEOUT.
+void stationnull (struct station *st) {
+
+  st->state = STATIONNULLS;
+
+  if (bpsend (&st->bp, "\0", 1) == -1) {
+    stationfail (st, strerror (errno), -1);
+    return;
+  }
+
+  st->nulls++;
+  st->deadline = bpmicros () + ((st->nulls < NULLCOUNT) ? NULLWAIT : RESPONSETIMEOUT) * 1000LL;
+}
+
+// The Bus Pirate isn't in I2C mode (see bpentermode) ... drain whatever it's still saying and send nulls until it
+// answers "BBIO1".  With a drain time we wait in STATIONDRAIN until it has been quiet for that long, without one we
+// only throw away what's already here (bpdrain with 0 doesn't wait).
+void stationentermode (struct station *st, int drain) {
+
+  st->nulls = 0;
+  bpdrain (&st->bp, 0);
+
+  if (drain > 0) {
+    st->state = STATIONDRAIN;
+    st->deadline = bpmicros () + drain * 1000LL;
+    return;
+  }
+
+  stationnull (st);
+}
+
+// The Bus Pirate sent us something.  Check as much of the response as we have and move on if the step is complete.
+void stationreceive (struct station *st) {
+
+  struct buspirate *bp;
+  struct commandstream *stream;
+  int i, received, checked, result;
+
+  bp = &st->bp;
+
+  if (bpreadavailable (bp) == -1) {
+    stationfail (st, strerror (errno), -1);
+    return;
+  }
+
+  // Leftovers ... throw them away and wait for DRAINTIMEOUT ms of silence (see stationentermode)
+  if (st->state == STATIONDRAIN) {
+    bp->rx.tail = bp->rx.head;
+    st->deadline = bpmicros () + DRAINTIMEOUT * 1000LL;
+    return;
+  }
+
+  // Keep waiting as long as the Bus Pirate keeps talking ... except for the mode probe, which gets PROBETIMEOUT no
+  // matter what (a partial or garbled answer there means we have to do the mode entry the long way), and the nulls,
+  // which have their own pace
+  if ((st->state != STATIONPROBE) && (st->state != STATIONNULLS)) {
+    st->deadline = bpmicros () + RESPONSETIMEOUT * 1000LL;
+  }
+
+  if (st->state == STATIONBANNER) {	// Don't care what it says
+    bp->rx.tail = bp->rx.head;
+    st->deadline = bpmicros () + BANNERTIMEOUT * 1000LL;
+    return;
+  }
+
+  // Mode probe ... "I2C1" and 0x1 if it's already in I2C mode.  Anything else gets drained and the nulls sort it out.
+  if (st->state == STATIONPROBE) {
+    if (RINGCOUNT (&bp->rx) < 5) {
+      return;
+    }
+
+    if (ringfind (&bp->rx, "I2C1\1", 5) == 0) {
+      bp->rx.tail = bp->rx.tail + 5;
+      st->deadline = bpmicros () + RESPONSETIMEOUT * 1000LL;	// Done with the probe's short deadline
+      bprecord (bp, STATMODE, st->sent);
+      stationnext (st);
+    }
+    else {
+      stationentermode (st, DRAINTIMEOUT);
+    }
+    return;
+  }
+
+  if (st->state == STATIONNULLS) {
+    i = ringfind (&bp->rx, "BBIO1", 5);
+
+    if (i >= 0) {
+      stationresume (st, i);
+    }
+    return;
+  }
+
+  // Mode entry ... skip the "BBIO1" answers to nulls that went out before we saw the first one
+  while ((st->state == STATIONMODE) && (ringfind (&bp->rx, "BBIO1", 5) == 0)) {
+    bp->rx.tail = bp->rx.tail + 5;
+  }
+
+  if ((st->state == STATIONMODE) || (st->state == STATIONSPEED) || (st->state == STATIONEXIT)) {
+    if (RINGCOUNT (&bp->rx) < st->expectedlength) {
+      return;
+    }
+
+    for (i = 0; i < st->expectedlength; i++) {
+      if ((RINGBYTE (&bp->rx, i) != st->expected[i]) && (st->state == STATIONMODE) && (st->modetries++ == 0)) {
+        stationentermode (st, DRAINTIMEOUT);	// Stale "BBIO1" ... once more after the leftovers stop
+        return;
+      }
+      if (RINGBYTE (&bp->rx, i) != st->expected[i]) {
+        bp->rx.tail = bp->rx.head;
+        stationfail (st, (st->state == STATIONMODE) ? "Could not enable I2C mode on Bus Pirate" :
+                     (st->state == STATIONSPEED) ? "Could not set I2C speed on Bus Pirate" :
+                     "Could not reset Bus Pirate to user mode", -1);
+        return;
+      }
+    }
+
+    bp->rx.tail = bp->rx.tail + st->expectedlength;
+    bprecord (bp, (st->state == STATIONMODE) ? STATMODE : (st->state == STATIONSPEED) ? STATSPEED : STATRESET,
+              st->sent);
+    stationnext (st);
+    return;
+  }
+
+  // A command stream ... check every transaction that's all here and charge it with the time since the last one
+  stream = &bp->stream;
+  received = RINGCOUNT (&bp->rx);
+
+  if (received > stream->responselength) {
+    received = stream->responselength;
+  }
+
+  if (st->write.wait == -1) {
+    checked = stream->checked;
+    result = streamcheck (stream, &bp->rx, received);
+
+    for (; checked < stream->checked; checked++) {
+      bprecord (bp, (stream->transactions[checked].type == TRANSPAGEWRITE) ? STATPAGEWRITE :
+                (stream->transactions[checked].type == TRANSACKPOLL) ? STATACKPOLL : STATREAD, st->sent);
+      st->sent = bpmicros ();
+    }
+
+    // A page still in its write cycle gets polled again once the rest of this batch has gone by (see streamwritebusy)
+    if ((result == -1) && ((st->state != STATIONWRITE) || (streamwritebusy (stream, &st->write) == -1))) {
+      stationfail (st, stream->error, stream->transactions[stream->failed].address);
+      return;
+    }
+  }
+
+  // Everything checked out (or we're waiting for a write cycle) once the whole response is here
+  if (RINGCOUNT (&bp->rx) < stream->responselength) {
+    return;
+  }
+
+  bp->rx.tail = bp->rx.tail + stream->responselength;
+  result = stationbatch (st);
+
+  if (result == -1) {
+    stationfail (st, strerror (errno), -1);
+  }
+  else if (result == 1) {
+    stationnext (st);
+  }
+}
+
+// Save what we read from Bus Pirate n (-r) to <prefix>-<n>.bin ... or <prefix>-<n>.hex (Intel HEX) if the prefix
+// ends in .hex.  name gets the file name.  Returns 0 or -1 on error.
+int stationsave (struct station *st, char *prefix, int n, char *name, int size) {
+
+  FILE *out;
+  char *extension;
+  int format;
+
+  format = imageformat (prefix);
+  extension = strrchr (prefix, '.');
+
+  if (format == IMAGEHEX) {
+    snprintf (name, size, "%.*s-%d%s", (int) (extension - prefix), prefix, n, extension);
+  }
+  else {
+    snprintf (name, size, "%s-%d.bin", prefix, n);
+  }
+
+  out = imagecreate (name);
+
+  if (out == NULL) {
+    return -1;
+  }
+
+  if (imagewrite (out, format, 0, st->current, profile->size) == -1) {
+    fclose (out);
+    return -1;
+  }
+
+  return imageclose (out, format);
+}
+
+int main (int argc, char *argv[]) {
+
+  // Define variables
+  struct station *stations;
+  struct station *st;
+  struct epoll_event event, events[MAXSTATIONS];
+  char *statsprefix, *imagefile, *outputprefix;
+  char statsname[256];
+  char outputname[256];
+  int epollfd, count, active, failed, option, result, i, j, timeout;
+  long long now, next;
+
+  statsprefix = NULL;
+  imagefile = NULL;
+  outputprefix = NULL;
+  failed = 0;
+
+  // Check the command line options
+  //  -r:  read every EEPROM instead of writing
+  //  -d:  differential mode ... read the EEPROM first and only write the pages that changed
+  //  -v:  verify mode ... read the EEPROM back after writing and rewrite any pages that don't match
+  //  -s:  I2C speed ... 5, 50, 100, 400 (kHz)
+  //  -j:  write the JSON summary for every Bus Pirate to <prefix>-<n>.json (n counts the ports from 0)
+  //  -o:  with -r, save every EEPROM to <prefix>-<n>.bin (or .hex if the prefix ends in .hex ... see stationsave)
+  //  -f:  write this image file (raw binary or Intel HEX ... .hex) instead of what we type in
+  //  -H:  framed image ... put a header with the length and CRC in front of the data (see framebuild)
+  //  -k:  keep the Bus Pirates in binary I2C mode when we're done
+  //  -e:  EEPROM on every bus ... 24LC08B (the default), 24LC256 or 24LC512
+  while ((option = getopt (argc, argv, "Hkrdvs:j:o:f:e:")) != -1) {
+    switch (option) {
+      case 'e':
+        profile = parseprofile (optarg);
+        break;
+      case 'r':
+        readonly = 1;
+        break;
+      case 'd':
+        differential = 1;
+        break;
+      case 'v':
+        verify = 1;
+        break;
+      case 's':
+        speed = parsespeed (optarg);
+
+        if ((speed == -1) || (speed == SPEEDAUTO)) {
+          fprintf (stderr, "Unknown I2C speed:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'j':
+        statsprefix = optarg;
+        break;
+      case 'o':
+        outputprefix = optarg;
+        break;
+      case 'f':
+        imagefile = optarg;
+        break;
+      case 'H':
+        framed = 1;
+        break;
+      case 'k':
+        keep = 1;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-r] [-d] [-v] [-s 5|50|100|400] [-j stats prefix] [-o image prefix] [-f image]\n"
+                 "       [-H] [-k] [-e 24LC08B|24LC256|24LC512] port [port ...]\n", argv[0]);
+        exit (1);
+    }
+  }
+
+  if ((outputprefix != NULL) && (!readonly)) {
+    fprintf (stderr, "-o only works with -r\n");
+    exit (1);
+  }
+
+  count = argc - optind;
+
+  if ((count < 1) || (count > MAXSTATIONS)) {
+    fprintf (stderr, "Give me 1 - %d serial ports\n", MAXSTATIONS);
+    exit (1);
+  }
+
+  // Get input from the image file (-f) or the terminal ... every EEPROM gets the same data.  With -H it goes behind a
+  // length and CRC header (see imageinput).
+  if (!readonly) {
+    imagelength = imageinput (imagefile, image, profile->size, framed);
+  }
+
+  stations = calloc (count, sizeof (struct station));
+  epollfd = epoll_create1 (0);
+
+  if ((stations == NULL) || (epollfd == -1)) {
+    perror ("Could not set up the event loop - ");
+    exit (1);
+  }
+
+  // Open every port and start the mode entry (see bpentermode).  With -k send the mode probe first:  a Bus Pirate
+  // that's still in I2C mode is ready to go right after it answers ... the others get the nulls when they answer
+  // (or don't).
+  active = 0;
+
+  for (i = 0; i < count; i++) {
+    st = &stations[i];
+    st->port = argv[optind + i];
+    st->started = bpmicros ();
+
+    if (bpopen (&st->bp, st->port) == -1) {
+      st->bp.error = strerror (errno);
+      st->state = STATIONFAILED;
+      continue;
+    }
+
+    bpsetprofile (&st->bp, profile);
+    event.events = EPOLLIN;
+    event.data.ptr = st;
+
+    if (epoll_ctl (epollfd, EPOLL_CTL_ADD, st->bp.fd, &event) == -1) {
+      stationfail (st, strerror (errno), -1);
+      continue;
+    }
+
+    st->sent = bpmicros ();
+
+    if (keep) {
+      bpdrain (&st->bp, 0);
+      st->deadline = bpmicros () + PROBETIMEOUT * 1000LL;
+
+      if (stationsimple (st, STATIONPROBE, MODEPROBE, 2, "I2C1\1", 5) == -1) {
+        stationfail (st, strerror (errno), -1);
+      }
+    }
+    else {
+      stationentermode (st, 0);
+    }
+
+    if (st->state < STATIONDONE) {
+      active++;
+    }
+  }
+
+  // The event loop.  Wait for the next Bus Pirate to answer (or the next deadline), handle it and go around again
+  // until every Bus Pirate is done or has failed.
+  while (active > 0) {
+    now = bpmicros ();
+    next = now + RESPONSETIMEOUT * 1000LL;
+
+    for (i = 0; i < count; i++) {
+      if ((stations[i].state < STATIONDONE) && (stations[i].deadline < next)) {
+        next = stations[i].deadline;
+      }
+    }
+
+    timeout = (next > now) ? (next - now + 999) / 1000 : 0;
+    result = epoll_wait (epollfd, events, MAXSTATIONS, timeout);
+
+    if ((result == -1) && (errno != EINTR)) {
+      perror ("Event loop failed - ");
+      exit (3);
+    }
+
+    for (j = 0; j < result; j++) {
+      st = events[j].data.ptr;
+
+      if (st->state < STATIONDONE) {
+        stationreceive (st);
+      }
+    }
+
+    // Anybody who has been quiet for too long is either done (the banner is over) or dead
+    now = bpmicros ();
+    active = 0;
+
+    for (i = 0; i < count; i++) {
+      st = &stations[i];
+
+      if ((st->state < STATIONDONE) && (now >= st->deadline)) {
+        if (st->state == STATIONBANNER) {
+          bpclose (&st->bp);
+          st->state = STATIONDONE;
+          st->finished = now;
+        }
+        else if (st->state == STATIONPROBE) {
+          stationentermode (st, 0);	// No answer ... user mode
+        }
+        else if (st->state == STATIONDRAIN) {
+          stationnull (st);		// Quiet at last
+        }
+        else if ((st->state == STATIONNULLS) && (st->nulls < NULLCOUNT)) {
+          stationnull (st);
+        }
+        else {
+          st->bp.stats.timeouts++;
+          stationfail (st, "Bus Pirate did not answer in time", -1);
+        }
+      }
+
+      if (st->state < STATIONDONE) {
+        active++;
+      }
+    }
+  }
+
+  // Report how every Bus Pirate did
+  for (i = 0; i < count; i++) {
+    st = &stations[i];
+
+    if (st->state == STATIONFAILED) {
+      failed++;
+
+      if (st->bp.erroraddress >= 0) {
+        printf ("%s:  FAILED  %s (address %d)\n", st->port, st->bp.error, st->bp.erroraddress);
+      }
+      else {
+        printf ("%s:  FAILED  %s\n", st->port, st->bp.error);
+      }
+    }
+    else if ((readonly) && (outputprefix != NULL) &&
+             (stationsave (st, outputprefix, i, outputname, sizeof (outputname)) == -1)) {
+      failed++;
+      printf ("%s:  FAILED  Could not write %s - %s\n", st->port, outputname, strerror (errno));
+    }
+    else if (readonly) {
+      printf ("%s:  OK  read %d bytes (CRC %04X", st->port, profile->size, crc16 (st->current, profile->size));
+
+      if (outputprefix != NULL) {
+        printf (", saved to %s", outputname);
+      }
+
+      printf (") in %.3f s\n", (st->finished - st->started) / 1e6);
+    }
+    else {
+      printf ("%s:  OK  wrote %d of %d pages", st->port, st->pages - st->skipped, st->pages);
+
+      if (verify) {
+        printf (", verified CRC %04X", crc16 (image, imagelength));
+      }
+
+      printf (" in %.3f s\n", (st->finished - st->started) / 1e6);
+    }
+
+    if (statsprefix != NULL) {
+      snprintf (statsname, sizeof (statsname), "%s-%d.json", statsprefix, i);
+
+      if (bpwritestats (&st->bp, statsname) == -1) {
+        fprintf (stderr, "Could not write %s - %s\n", statsname, strerror (errno));
+      }
+    }
+  }
+
+  close (epollfd);
+
+  if (failed) {
+    exit (4);
+  }
+}
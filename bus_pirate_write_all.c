@@ -5,6 +5,44 @@ This program uses the Bus Pirate to write user specified input from the terminal
 an 24LC08B EEPROM.  This program uses Canonical input (default).  Canonical input
 offers no advantage for this program; it's just the default.
 
+Version 3.0:  -e picks the EEPROM (24LC08B, 24LC256 or 24LC512).  Page writes are as big as that EEPROM's page
+(up to 128 bytes) and get enough ACK polls for its write cycle.
+
+Version 2.9:  Verify uses the library's shadow copy of the EEPROM.  The first pass reads everything, a retry only
+reads back the pages it rewrote.
+
+Version 2.8:  Page-commit journal (-J file or --resume).  Each batch of pages is read back after it has been
+written and every page that landed gets a line in the journal (flushed to disk right away).  If the run
+dies halfway (flaky USB hub!), --resume skips straight to the first page that isn't in the journal.
+
+Version 2.7:  All the Bus Pirate code (serial port, modes, speeds, command streams) moved into the
+shared library in bus_pirate.c ... this file is just the front-end now.
+
+Version 2.6:  Verify mode (-v).  After writing, read the data back in big sequential bursts and
+compare it byte for byte with the input.  On a mismatch, report the bad pages and rewrite only those.
+
+Version 2.5:  Differential mode (-d).  Read the EEPROM first, compare it page by page with the
+input and only write the pages that are different.  Most of a configuration image usually hasn't
+changed, so this skips most of the write cycles (and the wear that goes with them).
+
+Version 2.4:  Use all 4 blocks (1024 bytes) of the 24LC08B.  The block number goes in the device
+address (0xA0, 0xA2, 0xA4, 0xA6), so a single run can write the whole EEPROM.
+
+Version 2.3:  Pipeline the page writes.  A command stream holds up to 8 page writes, each one followed
+by enough ACK polls to cover the EEPROM's write cycle, and goes out in a single write.  The responses
+are checked transaction by transaction as they come in, so we still find out exactly which page failed.
+
+Version 2.2:  Stay in I2C mode for the whole write.  We used to tear down I2C mode, reset the
+Bus Pirate and read the version banner after every write ... which (by accident) gave the EEPROM
+enough time to finish its internal write cycle.  Now we ACK poll instead:  keep sending the device
+address until the EEPROM ACKs it (it NACKs while it's busy) and then move on to the next page.
+
+Version 2.1:  Write a page (16 bytes) at a time.  Each write is planned so that it starts at the current
+address and stops at the end of its page ... aligned data gets full page writes, an unaligned start
+just gets a shorter first write.  A page write is more than one bulk write command can carry (16 bytes
+including the device address and write address), so we send the page as two bulk write commands between
+a single start and stop bit.  The EEPROM can't tell the difference.
+
 Version 2.0:  Use bulk write to send data 8 bytes at a time.  Use a character array to
 hold the BB enable, I2C enable, power/pullup, start bit, bulk write command, data, and stop bit.
 Yes ... everything for a complete write cycle in the array.  This will write in blocks of
@@ -23,247 +61,358 @@ And finally, thanks to the excellent tutorials on the Bus Pirate web site.
 */ 
 
 #include <stdio.h>
-#include <unistd.h>
-#include <termios.h>		// POSIX terminal control definitions
 #include <errno.h>		// Error number definitions
-#include <fcntl.h>		// File control definitions
-#include <strings.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <getopt.h>		// getopt_long for --resume
+
+#include "bus_pirate.h"
+
+#define VERIFYRETRIES 3					 // Number of times to rewrite bad pages before we give up
+#define JOURNALFILE "bus_pirate_write_all.journal"	 // Default journal for --resume
+
+char *statsfile = NULL;				// -j:  where to write the JSON summary
+
+// The journal is a text file.  The first line says which image it's for and every line after that is a page that has
+// been written and read back OK:
+//   image <address> <length> <crc16>
+//   page <address> <length> <crc16>
+
+// Find the first page we still have to write.  Only trust the journal if it's for this exact image (same address,
+// length and CRC), the page CRCs match the data and every page is the page this EEPROM would write there (a journal
+// from an EEPROM with smaller pages doesn't cover our pages).  Returns the EEPROM address to start writing at (address
+// if there's no journal or it's no good).
+int journalresume (char *name, const struct eepromprofile *profile, int address, char *data, int length) {
+
+  FILE *journal;
+  char line[80];
+  char committed[EEPROMMAX];
+  int imageaddress, imagelength, imagecrc, pageaddress, pagelength, pagecrc, resume;
+
+  journal = fopen (name, "r");
+
+  if (journal == NULL) {
+    return address;
+  }
+
+  if ((fgets (line, sizeof (line), journal) == NULL) ||
+      (sscanf (line, "image %d %d %x", &imageaddress, &imagelength, &imagecrc) != 3) ||
+      (imageaddress != address) || (imagelength != length) || (imagecrc != crc16 (data, length))) {
+    printf ("Journal %s is for a different image ... starting over\n", name);
+    fclose (journal);
+    return address;
+  }
+
+  bzero (committed, sizeof (committed));
+
+  while (fgets (line, sizeof (line), journal) != NULL) {
+    if ((sscanf (line, "page %d %d %x", &pageaddress, &pagelength, &pagecrc) == 3) && (pageaddress >= address) &&
+        (pageaddress < address + length) && (pagelength > 0) && (pagelength <= address + length - pageaddress) &&
+        (pagelength == planwrite (profile, pageaddress, address + length - pageaddress)) &&
+        (crc16 (&data[pageaddress - address], pagelength) == pagecrc)) {
+      committed[pageaddress] = 1;
+    }
+  }
 
-#define BUFFERSIZE 256
-#define DEBUG
+  fclose (journal);
 
-int main (void) {
+  for (resume = address; (resume < address + length) && (committed[resume]);
+       resume = resume + planwrite (profile, resume, address + length - resume));
+
+  return resume;
+}
+
+// Start a new journal (or keep adding to the one we're resuming).  Returns NULL on error.
+FILE *journalopen (char *name, int address, char *data, int length, int append) {
+
+  FILE *journal;
+
+  journal = fopen (name, (append) ? "a" : "w");
+
+  if ((journal != NULL) && (!append)) {
+    fprintf (journal, "image %d %d %04X\n", address, length, crc16 (data, length));
+  }
+
+  return journal;
+}
+
+// Record a page that has been written and read back OK.  Push it all the way to the disk ... the whole point is that
+// it survives whatever kills us next.  Returns 0 or -1 on error.
+int journalcommit (FILE *journal, int address, char *data, int length) {
+
+  fprintf (journal, "page %d %d %04X\n", address, length, crc16 (data, length));
+
+  if (fflush (journal) != 0) {
+    return -1;
+  }
+
+  return fsync (fileno (journal));
+}
+
+int main (int argc, char *argv[]) {
 
   // Define variables
-  int fd, result, i, j, k, writeaddress, inputbuffercount, numloops;
-  struct termios portopts;
-  char BPbuffer[BUFFERSIZE];
-  char inputbuffer[BUFFERSIZE];
-  char addressbuffer[1];
-  char writebuffer[38]; 		// This is our main working buffer ... all the Bus Pirate commands go here.
-
-  result = 0;
+  int result, i, j, writeaddress, inputbuffercount, inputlength, option, differential, verify, speed, framed, keep;
+  int pages, skipped, rewritepages, rewriteskipped, resume, resumeaddress, done, count, k;
+  struct buspirate bp;
+  struct option longoptions[] = {{"resume", no_argument, NULL, 'R'}, {NULL, 0, NULL, 0}};
+  char *port, *imagefile, *journalfile, *what;
+  FILE *journal;
+  const struct eepromprofile *profile;
+  char inputbuffer[EEPROMMAX + 1];	// Room for the whole EEPROM + the null at the end
+  char currentbuffer[EEPROMMAX];	// What's in the EEPROM right now (differential and verify mode)
+
   writeaddress = 0;
+  profile = &profiles[0];
   inputbuffercount = 0;
-  numloops = 0;
-  bzero (BPbuffer, sizeof (BPbuffer));
+  inputlength = 0;
+  differential = 0;
+  verify = 0;
+  speed = SPEEDDEFAULT;
+  port = "/dev/ttyUSB0";
+  keep = 0;
+  imagefile = NULL;
+  framed = 0;
+  journalfile = NULL;
+  journal = NULL;
+  resume = 0;
+  pages = 0;
+  skipped = 0;
+  rewritepages = 0;
+  rewriteskipped = 0;
   bzero (inputbuffer, sizeof (inputbuffer));
-  bzero (writebuffer, sizeof (writebuffer));
-  bzero (addressbuffer, sizeof (addressbuffer)); 
-
-  // Populate the writebuffer with our static values (such as the 20 null bytes for bitbang enable) and dynamic values
-  // (such as the data bytes).  Later on (inside the loop), we'll overwrite the dynamic values.
-  //  - enable bitbang:  20 null bytes (\0) ... since we used bzero above we don't need to populate these values!
-  //  - enable I2C:  \2
-  //  - enable power and pullup:  \x4C
-  //  - start bit: \2
-  //  - 8 byte bulk write command:  \x19
-  //  - device write address:  \xA0
-  //  - write address:  dynamic ... will change each time through loop ... use 0xAA for placeholder
-  //  - data bytes:  dynamic ... will change each time through loop ... use 0xBB for placeholders
-  //  - stop bit:  \3 
-  //  - disable I2C:  \0
-  //  - disable bitbang:  \xF
-  //  - our special flag to help spot end of buffer during debugging:  \xEE
-  writebuffer[20] = '\2';
-  writebuffer[21] = '\x4C';
-  writebuffer[22] = '\2';
-  writebuffer[23] = '\x1F';
-  writebuffer[24] = '\xA0';
-  writebuffer[25] = '\xAA';
-
-  for (i = 26; i < 34; i++) {
-    writebuffer[i] = '\xBB';
+
+  // Check the command line options
+  //  -d:  differential mode ... read the EEPROM first and only write the pages that changed
+  //  -v:  verify mode ... read the EEPROM back after writing and rewrite any pages that don't match
+  //  -s:  I2C speed ... 5, 50, 100, 400 (kHz) or auto (find the fastest speed that works)
+  //  -p:  serial port the Bus Pirate is attached to (like the pty from bus_pirate_emulator)
+  //  -k:  keep the Bus Pirate in binary I2C mode when we're done (the next program doesn't have to wait for it)
+  //  -j:  write round trip latencies and syscall counters to this file as JSON when we're done (- is stdout)
+  //  -f:  write this image file (raw binary or Intel HEX ... .hex) instead of what we type in
+  //  -H:  framed image ... put a header with the length and CRC in front of the data (see framebuild)
+  //  -J:  keep a page-commit journal in this file
+  //  --resume (-R):  skip the pages the journal says are already done (journal is bus_pirate_write_all.journal
+  //                  unless -J says otherwise)
+  //  -e:  EEPROM on the bus ... 24LC08B (the default), 24LC256 or 24LC512
+  while ((option = getopt_long (argc, argv, "Hdvs:p:j:f:J:Rke:", longoptions, NULL)) != -1) {
+    switch (option) {
+      case 'e':
+        profile = parseprofile (optarg);
+        break;
+      case 'd':
+        differential = 1;
+        break;
+      case 'v':
+        verify = 1;
+        break;
+      case 's':
+        speed = parsespeed (optarg);
+
+        if (speed == -1) {
+          fprintf (stderr, "Unknown I2C speed:  %s\n", optarg);
+          exit (1);
+        }
+        break;
+      case 'p':
+        port = optarg;
+        break;
+      case 'k':
+        keep = 1;
+        break;
+      case 'j':
+        statsfile = optarg;
+        break;
+      case 'f':
+        imagefile = optarg;
+        break;
+      case 'H':
+        framed = 1;
+        break;
+      case 'J':
+        journalfile = optarg;
+        break;
+      case 'R':
+        resume = 1;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-d] [-v] [-s 5|50|100|400|auto] [-p port] [-j stats.json] [-f image] [-H]\n"
+                "       [-J journal] [--resume] [-k] [-e 24LC08B|24LC256|24LC512]\n", argv[0]);
+        exit (1);
+    }
+  }
+
+  // Get input from the image file (-f) or the terminal ... with -H behind a length and CRC header (see imageinput)
+  inputlength = imageinput (imagefile, inputbuffer, profile->size, framed);
+
+  // Journal ... with --resume, find the first page that isn't in the journal yet
+  resumeaddress = writeaddress;
+
+  if ((resume) && (journalfile == NULL)) {
+    journalfile = JOURNALFILE;
   }
 
-  writebuffer[34] = '\3';
-  writebuffer[35] = '\0';
-  writebuffer[36] = '\xF';
-  writebuffer[37] = '\xEE';		// Special flag ... look for this flag in gdb:  x/38xb writebuffer
+  if (journalfile != NULL) {
+    if (resume) {
+      resumeaddress = journalresume (journalfile, profile, writeaddress, inputbuffer, inputlength);
 
-  // Get input from terminal
-  printf ("Enter to end (%d chars max)> ", BUFFERSIZE);
-  fgets (inputbuffer, BUFFERSIZE, stdin);
+      if (resumeaddress != writeaddress) {
+        printf ("Resuming at address %d\n", resumeaddress);
+      }
+    }
 
-  // Open the serial port.  The Bus Pirate will be attached as /dev/ttyUSB0.  Open the port with R/W, no delay and "no controlling
-  // terminal" options.  The latter option will keep unwanted keyboard abort signals from affecting this program.
-  fd = open ("/dev/ttyUSB0",O_RDWR | O_NOCTTY | O_NDELAY);
+    journal = journalopen (journalfile, writeaddress, inputbuffer, inputlength, resumeaddress != writeaddress);
 
-  if (result == -1) {
-    perror ("Unable to open /dev/ttyUSB0 - ");
-    exit(1);
+    if (journal == NULL) {
+      fprintf (stderr, "Could not open journal %s - %s\n", journalfile, strerror (errno));
+      exit (1);
+    }
   }
 
-  // Change the serial device (fd) flags ... clear all flags ... a brute force way to clear the O_NDELAY flag so
-  // that the program will block and wait for input from serial device before executing read.  Otherwise, the Bus
-  // Pirate will not be able to process the write and send input to read fast enough.
-  // result =  fcntl(fd, F_SETFL, 0);
-
-  if (result == -1) {
-    perror("Cannot set serial device flag - ");
-    close (fd);
-    exit(7);
-  } 
-
-  // Set serial port options for the Bus Pirate.  Use the termios structure (available in termios.h) and it's associated
-  // constants to set the options.  Before you can set the options, you have to initialize your portopts structure by
-  // getting the existing port options.  The options don't take effect until you call tcsetattr.  Use the TCSANOW constant
-  // to set the settings IMMEDIATELY. Unlike speed, there is no function to set the character size and parity.  Just use
-  // bit masking to set these settings (8N1).
-  tcgetattr (fd, &portopts);
-  memset (&portopts, 0, sizeof(struct termios)); // Initialize all elements of the portopts structure to 0
-  cfsetspeed (&portopts,B115200);
-  tcsetattr (fd, TCSANOW, &portopts);
-  portopts.c_cflag &= ~PARENB;	// Disable parity bit ... note the use of bitwise NOT (~) in front of constant
-  portopts.c_cflag &= ~CSTOPB;  // Disable 2 stop bits ... use 1 stop instead ... note the use of bitwise NOT as above
-  portopts.c_cflag &= ~CSIZE;   // Clear the existing character size bits ... again ... note the use of bitwise NOT
-  portopts.c_cflag &= CS8;      // Set the mask bits for 8 characters
-
-  // Figure out how many times we have to loop through the input buffer to process all the data.  We're writing in
-  // blocks of 8 bytes ... so loop for every 8 bytes in the input buffer.  Also, we have to account for special cases:  
-  // 1) when the input buffer is less than 8 characters (including new line) and 2) when the input buffer
-  // has less than 8 characters in the last loop.
-  numloops = strlen (inputbuffer) / 8;
-
-  if (numloops == 0) {
-    numloops = 1;
+  // Open the serial port (/dev/ttyUSB0 unless -p says otherwise), put the Bus Pirate in binary I2C mode (power and
+  // pullups on), find out if it can do "write then read" (differential and verify reads) and set the I2C bus speed
+  // (-s) ... see bpstart.  We only do this once ... the Bus Pirate stays in I2C mode until we're done with every page.
+  result = bpstart (&bp, port, profile, speed, keep, &what);
+
+  if (result != 0) {
+    bpfail (&bp, result, what, statsfile);
   }
-  else if (strlen (inputbuffer) % 8 > 0) {
-    numloops = numloops++;
+
+  // Differential mode ... read what's in the EEPROM right now so we only write the pages that are different.  Reads
+  // are a lot cheaper than write cycles (and they don't wear out the EEPROM).
+  if (differential) {
+    result = bpshadowread (&bp, writeaddress, &currentbuffer[writeaddress], inputlength);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
+    }
   }
 
-  // Now do your main loop ... loop once for every 8 bytes
-  for (i = 0; i < numloops; i++) {
-
-    // Populate the write buffer with dynamic values for write address
-    writebuffer[25] = writeaddress;
-  
-    // Populate the write buffer with dynamic values for data.  Loop through the input buffer 8 bytes at a 
-    // time ... test for the new line character for the end of data.  When you get out of the loop, j will be
-    // equal to the number of data bytes.  We'll use j later on to patch our write buffer and parse the 
-    // responses.
-    for (j = 0; j < 8; j++) {
-      writebuffer[26 + j] = inputbuffer[inputbuffercount];
-      inputbuffercount++;
-      if (inputbuffer[j] == 10) {
-        j++;
-        break;
-      }
+  // Now write the data.  Planned page writes (each one followed by its ACK polls) are queued in the command stream
+  // STREAMPAGES at a time, each batch goes out with a single write and the responses are checked as they come in.  In
+  // differential mode, skip any page that already holds the data we want.
+  if (journalfile == NULL) {
+    result = bpwriterange (&bp, writeaddress, inputbuffer, inputlength, (differential) ? currentbuffer : NULL, &pages,
+                           &skipped);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not send command stream to Bus Pirate", statsfile);
     }
-    
-    // Patch the write buffer with the new bulk write command, stop bit, disable I2C and disable bitbang bytes
-    writebuffer[23] = 16 + 1 + j;	// The new bulk write command: 16 for bulk write + 1 for device address and write address
-					// + j for the number of data bytes.  Yes ... 1 for device address and write address.
-    writebuffer[26 + j] = '\3';		// Stop bit
-    writebuffer[27 + j] = '\0';		// Disable I2C
-    writebuffer[28 + j] = '\xF';    	// Disable bitbang
-    writebuffer[29 + j] = '\xEE'; 	// Our special EOB for debugging
-
-    // Send the entire write buffer ... you'll always send at least 29 bytes + the number of data bytes (j)
-    result = write(fd, writebuffer, 29 + j);
-     
-    if (result == -1) {
-      perror("Cannot send write buffer to Bus Pirate - ");
-      close (fd);
-      exit(2);
-    } 
- 
-    // Now read the input from Bus Pirate and parse to determine status of write.  You'll always read at least 21 bytes
-    // + the number of data bytes (j)
-    // Number of response bytes from Bus Pirate
-    // Enable bitbang:		5
-    // Enable I2C:		4
-    // Power and Pullup:	1
-    // Start:			1
-    // 8 byte bulk write:	1
-    // Device address:		1
-    // Write address:		1
-    // Number of data bytes:	j + 1
-    // Stop bit:		1
-    // Disable I2C:		5
-    // Disable bitbang:		1
-    // Total:			21 + j + 1
-    usleep (10000);
-    result = read(fd, &BPbuffer, 21 + j + 1);
-  
-    if (result <= 0 ) {
-      perror("Could not read output from Bus Pirate - ");
-      close (fd);
-      exit (3);
+  }
+
+  // With a journal, write a batch (STREAMPAGES pages) at a time, read the batch back and put every page that landed
+  // in the journal before we move on.  A page that didn't land is an error ... the journal only ever holds good pages.
+  else {
+    for (done = resumeaddress - writeaddress; done < inputlength; done = done + count) {
+      for (count = 0, k = 0; (k < STREAMPAGES) && (done + count < inputlength); k++) {
+        count = count + planwrite (profile, writeaddress + done + count, inputlength - done - count);
+      }
+
+      result = bpwriterange (&bp, writeaddress + done, &inputbuffer[done], count, (differential) ? currentbuffer : NULL,
+                             &pages, &skipped);
+
+      if (result != 0) {
+        bpfail (&bp, result, "Could not send command stream to Bus Pirate", statsfile);
+      }
+
+      result = bpreadrange (&bp, writeaddress + done, &currentbuffer[writeaddress + done], count);
+
+      if (result != 0) {
+        bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
+      }
+
+      for (i = done; i < done + count; i = i + j) {
+        j = planwrite (profile, writeaddress + i, done + count - i);
+
+        if (memcmp (&currentbuffer[writeaddress + i], &inputbuffer[i], j) != 0) {
+          printf ("Verify failed for page at address %d (%d bytes) ... run again with --resume\n", writeaddress + i, j);
+          bpquit (&bp, 5, statsfile);
+        }
+
+        if (journalcommit (journal, writeaddress + i, &inputbuffer[i], j) == -1) {
+          fprintf (stderr, "Could not write journal %s - %s\n", journalfile, strerror (errno));
+          bpquit (&bp, 3, statsfile);
+        }
+      }
     }
+  }
 
-    if (strncmp("BBIO1", BPbuffer, 5) != 0) {
-      puts ("Could not enable binary mode on Bus Pirate");
-      close (fd);
-      exit (4);
+  // Verify mode ... an ACK for every data byte doesn't prove the data landed.  Read the whole range back in big
+  // sequential bursts and compare it with the input byte for byte (the CRC is only for the printout).  If they don't
+  // match, find the pages that are bad, report them and write just those pages again (a differential write against
+  // what we read back).  Give up after VERIFYRETRIES tries.  The first pass has to go to the EEPROM for everything
+  // (bprevalidate), after that only the rewritten pages are read again ... the rest comes from the shadow copy.
+  for (i = 0; (verify) && (i <= VERIFYRETRIES); i++) {
+    if (i == 0) {
+      result = bprevalidate (&bp, writeaddress, &currentbuffer[writeaddress], inputlength);
     }
-    if (strncmp("BBIO1I2C1", BPbuffer, 9) != 0) {
-      puts ("Could not enable I2C mode on Bus Pirate");
-      close (fd);
-      exit (4);
+    else {
+      result = bpshadowread (&bp, writeaddress, &currentbuffer[writeaddress], inputlength);
     }
-    if (BPbuffer[9] != 1) {
-      puts ("Could not enable power and pullup  on Bus Pirate");
-      close (fd);
-      exit (4);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not read EEPROM contents from Bus Pirate", statsfile);
     }
-    if (BPbuffer[10] != 1) {
-      puts ("Start bit error on Bus Pirate");
-      close (fd);
-      exit (4);
+
+    if (memcmp (&currentbuffer[writeaddress], inputbuffer, inputlength) == 0) {
+      printf ("Verified %d bytes (CRC %04X)\n", inputlength, crc16 (inputbuffer, inputlength));
+      break;
+    }
+
+    if (i == VERIFYRETRIES) {
+      puts ("Verify failed ... giving up");
+      bpquit (&bp, 5, statsfile);
     }
-    if (BPbuffer[11] != 1) {
-      puts ("Bulk write command error on Bus Pirate");
-      close (fd);
-      exit (4);
-    } 
-    if (BPbuffer[12] != 0) {
-      puts ("Did not receive ACK for write device address from Bus Pirate");
-      close (fd);
-      exit (4);
-    } 
-    if (BPbuffer[13] != 0) {
-      puts ("Did not receive ACK for write address from Bus Pirate");
-      close (fd);
-      exit (4);
-    } 
-    for (k = 0; k < j; k++) {  		
-
-      if (BPbuffer[14 + k] != 0) {
-        puts ("Did not recieve ACK for data byte from Bus Pirate");
-        close (fd);
-        exit (4);
+
+    for (inputbuffercount = 0; inputbuffercount < inputlength; inputbuffercount = inputbuffercount + j) {
+      j = planwrite (profile, writeaddress + inputbuffercount, inputlength - inputbuffercount);
+
+      if (memcmp (&currentbuffer[writeaddress + inputbuffercount], &inputbuffer[inputbuffercount], j) != 0) {
+        printf ("Verify failed for page at address %d (%d bytes) ... rewriting\n", writeaddress + inputbuffercount, j);
       }
     }
-    if (BPbuffer[14 + k] != 1) {		// Don't forget that k will be incremented to 8 when it drops out of the loop
-      puts ("Stop bit error on Bus Pirate");
-      close (fd);
-      exit (4);
+
+    result = bpwriterange (&bp, writeaddress, inputbuffer, inputlength, currentbuffer, &rewritepages, &rewriteskipped);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not send command stream to Bus Pirate", statsfile);
     }
-    if ((BPbuffer[15 + k] != 'B') && (BPbuffer[16 + k] != 'B') && (BPbuffer[17 + k] != 'I') && (BPbuffer[18 + k] != 'O')) {
-      puts ("Could not disable binary mode on Bus Pirate");
-      close (fd);
-      exit (4);
+
+    // Write-through put what we sent in the shadow copy ... we want to know what landed
+    for (inputbuffercount = 0; inputbuffercount < inputlength; inputbuffercount = inputbuffercount + j) {
+      j = planwrite (profile, writeaddress + inputbuffercount, inputlength - inputbuffercount);
+
+      if (memcmp (&currentbuffer[writeaddress + inputbuffercount], &inputbuffer[inputbuffercount], j) != 0) {
+        bpshadowinvalidate (&bp, writeaddress + inputbuffercount, j);
+      }
     }
-    if (BPbuffer[20 + k] != 1) {
-      puts ("Could not reset Bus Pirate to user mode");
-      close (fd);
-      exit (4);
+  }
+
+  // Disable I2C mode and binary mode ... put the Bus Pirate back into user mode.  With -k leave it in I2C mode (power
+  // and pullups on) so the next program gets going with a single round trip (see bpentermode).
+  if (!keep) {
+    result = bpexitmode (&bp);
+
+    if (result != 0) {
+      bpfail (&bp, result, "Could not reset Bus Pirate to user mode", statsfile);
     }
-    
-    // Once back in user mode, the Bus Pirate will print hardware and firmware version ... read this output before
-    // trying to enter binary mode again.  And yes, it takes 2 reads to read this output.
-    usleep (10000);
-    result = read(fd, &BPbuffer, 132);
-    usleep (10000);
-    result = read(fd, &BPbuffer, 132);
-    
-    // Increment writeaddress
-    writeaddress = writeaddress + j;
   }
 
   // Close the serial port
-  close (fd);
+  bpclose (&bp);
+
+  // Everything made it ... the journal has done its job
+  if (journal != NULL) {
+    fclose (journal);
+    unlink (journalfile);
+  }
+
+  if ((statsfile != NULL) && (bpwritestats (&bp, statsfile) == -1)) {
+    fprintf (stderr, "Could not write %s - %s\n", statsfile, strerror (errno));
+  }
+
+  if (differential) {
+    printf ("Wrote %d of %d pages (%d unchanged)\n", pages - skipped, pages, skipped);
+  }
 }